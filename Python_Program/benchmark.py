@@ -0,0 +1,236 @@
+# Statistical benchmark of the OMPL plugin.
+#
+# Runs every (scenario, algorithm) pair repeatedly until the bootstrap
+# confidence interval of the median planning time is narrower than a target
+# fraction of the median (or until --max-runs is reached), then stores a
+# summary for the run tag and, if a baseline tag is given, flags the pairs
+# which got significantly slower (Mann-Whitney U test).
+#
+# Planning times, seeds and validity check counts are the ones measured by the
+# plugin itself (solve_stats table), so remote API latency does not add noise.
+# The plugin only records them if V-REP is started with the SIM_OMPL_SOLVE_STATS
+# environment variable set to the path of the database (db_file below).
+#
+# With --perf, hardware counters (cycles, instructions, cache and branch
+# misses) are stored too, per run and per validity check. V-REP must then be
+# started with the SIM_OMPL_PERF_COUNTERS environment variable set, and the
+# kernel must allow perf_event_open (perf_event_paranoid <= 2).
+#
+# Load the scene and start V-REP as for main.py, then run e.g.:
+#   python benchmark.py --tag after-change --baseline before-change
+
+import argparse
+import math
+import sqlite3
+
+import numpy as np
+
+import vrep
+
+base_name = "/home/lamy/Desktop/OMPL_Compare_Task/VREP_Test_Maps/"
+db_file = base_name + 'scenarios.db'
+
+algorithms = {'RRT': 30018, 'RRTConnect': 30019, 'SBL': 30021}
+
+counters = ['cycles', 'instructions', 'cache_misses', 'branch_misses']
+
+
+def parseState(s):
+    return list(np.fromstring(s.replace("[", "").replace("]", ""), dtype='float', sep=' '))
+
+
+def loadScenarios(cursor, first, last):
+    cursor.execute('SELECT scenario_id, map_name, start_state, goal_state FROM scenarios WHERE scenario_id BETWEEN ? AND ? ORDER BY scenario_id', (first, last))
+    return [(i, "{}{}.stl".format(base_name, m), parseState(s), parseState(g)) for i, m, s, g in cursor.fetchall()]
+
+
+def addColumns(cursor, table, columns):
+    # for tables created by an older version of this script / the plugin
+    cursor.execute('PRAGMA table_info({})'.format(table))
+    existing = set(r[1] for r in cursor.fetchall())
+    for column, columnType in columns:
+        if column not in existing:
+            cursor.execute('ALTER TABLE {} ADD COLUMN {} {}'.format(table, column, columnType))
+
+
+def createTables(cursor):
+    cursor.execute('CREATE TABLE IF NOT EXISTS solve_stats (solve_id INTEGER PRIMARY KEY AUTOINCREMENT, task_name TEXT, algorithm_name TEXT, seed INTEGER, solved INTEGER, planning_time DOUBLE, validity_checks INTEGER, collision_checks INTEGER)')
+    cursor.execute('CREATE TABLE IF NOT EXISTS benchmark_runs (experiment_id INTEGER PRIMARY KEY REFERENCES results (experiment_id), data_tag TEXT, seed INTEGER, solved INTEGER)')
+    cursor.execute('CREATE TABLE IF NOT EXISTS benchmark_summary (data_tag TEXT, scenario_id INTEGER REFERENCES scenarios (scenario_id), algorithm_name TEXT, runs INTEGER, success_rate DOUBLE, median_planning_time DOUBLE, ci_low DOUBLE, ci_high DOUBLE, p10 DOUBLE, p25 DOUBLE, p75 DOUBLE, p90 DOUBLE, avg_planning_time DOUBLE, std_planning_time DOUBLE, avg_validity_checks DOUBLE, PRIMARY KEY (data_tag, scenario_id, algorithm_name))')
+    addColumns(cursor, 'solve_stats', [(c, 'INTEGER') for c in counters])
+    addColumns(cursor, 'benchmark_runs', [(c, 'INTEGER') for c in counters])
+    # medians over the runs of the counters divided by the validity checks:
+    addColumns(cursor, 'benchmark_summary', [(c + '_per_check', 'DOUBLE') for c in counters] + [('instructions_per_cycle', 'DOUBLE')])
+
+
+def lastSolveId(cursor):
+    cursor.execute('SELECT MAX(solve_id) FROM solve_stats')
+    row = cursor.fetchone()
+    return row[0] if row[0] is not None else 0
+
+
+def bootstrapMedianCI(times, confidence, resamples, rng):
+    times = np.asarray(times)
+    samples = rng.choice(times, size=(resamples, len(times)), replace=True)
+    medians = np.median(samples, axis=1)
+    alpha = (1.0 - confidence) / 2.0
+    return np.percentile(medians, 100 * alpha), np.percentile(medians, 100 * (1 - alpha))
+
+
+def mannWhitneyU(a, b):
+    # one-sided test of "a tends to be larger than b", normal approximation
+    # with tie correction; returns the p-value
+    a = np.asarray(a)
+    b = np.asarray(b)
+    n1, n2 = len(a), len(b)
+    values = np.concatenate([a, b])
+    order = values.argsort()
+    ranks = np.empty(len(values))
+    sortedValues = values[order]
+    i = 0
+    while i < len(values):
+        j = i
+        while j + 1 < len(values) and sortedValues[j + 1] == sortedValues[i]:
+            j += 1
+        ranks[order[i:j + 1]] = (i + j) / 2.0 + 1
+        i = j + 1
+    u = ranks[:n1].sum() - n1 * (n1 + 1) / 2.0
+    _, counts = np.unique(values, return_counts=True)
+    n = n1 + n2
+    sigma2 = n1 * n2 / 12.0 * ((n + 1) - ((counts ** 3 - counts).sum()) / (n * (n - 1)))
+    if sigma2 <= 0:
+        return 1.0
+    z = (u - n1 * n2 / 2.0 - 0.5) / math.sqrt(sigma2)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def runOnce(clientID, inInts, config, cursor, connect):
+    emptyBuff = bytearray()
+    before = lastSolveId(cursor)
+    res, retInts, path, retStrings, retBuffer = vrep.simxCallScriptFunction(clientID, 'remoteApiCommandServer', vrep.sim_scripttype_childscript, 'findPath_goalIsState', inInts, config, [], emptyBuff, vrep.simx_opmode_oneshot_wait)
+    connect.commit()
+    cursor.execute('SELECT seed, solved, planning_time, validity_checks, {} FROM solve_stats WHERE solve_id > ? ORDER BY solve_id'.format(', '.join(counters)), (before,))
+    rows = cursor.fetchall()
+    if not rows:
+        raise RuntimeError('the plugin did not record any solve_stats row; is it up to date, and was V-REP started with SIM_OMPL_SOLVE_STATS={}?'.format(db_file))
+    # findPath_goalIsState may call solve() several times (searchCount); a
+    # run counts as the sum of them, and as solved if any of them succeeded
+    seed = rows[0][0]
+    solved = any(r[1] for r in rows) and res == 0 and len(path) > 0
+    planningTime = sum(r[2] for r in rows)
+    checks = sum(r[3] for r in rows)
+    # counter values, or None if the plugin did not record them:
+    if all(r[4 + i] is not None for r in rows for i in range(len(counters))):
+        counts = [sum(r[4 + i] for r in rows) for i in range(len(counters))]
+    else:
+        counts = None
+    return seed, solved, planningTime, checks, counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Statistical benchmark of the OMPL plugin')
+    parser.add_argument('--tag', required=True, help='data tag under which the runs are stored')
+    parser.add_argument('--baseline', help='data tag of a previous benchmark to compare against')
+    parser.add_argument('--first-scenario', type=int, default=0)
+    parser.add_argument('--last-scenario', type=int, default=1 << 30)
+    parser.add_argument('--algorithms', default='RRTConnect', help='comma separated, among ' + ', '.join(sorted(algorithms)))
+    parser.add_argument('--ci-width', type=float, default=0.1, help='target width of the confidence interval of the median, relative to the median')
+    parser.add_argument('--confidence', type=float, default=0.95)
+    parser.add_argument('--min-runs', type=int, default=10)
+    parser.add_argument('--max-runs', type=int, default=200)
+    parser.add_argument('--significance', type=float, default=0.01, help='p-value below which a slowdown is reported')
+    parser.add_argument('--resamples', type=int, default=2000, help='bootstrap resamples')
+    parser.add_argument('--perf', action='store_true', help='require and store hardware performance counters')
+    args = parser.parse_args()
+
+    names = args.algorithms.split(',')
+    for name in names:
+        if name not in algorithms:
+            parser.error('unknown algorithm: ' + name)
+
+    connect = sqlite3.connect(db_file)
+    cursor = connect.cursor()
+    createTables(cursor)
+    connect.commit()
+    scenarios = loadScenarios(cursor, args.first_scenario, args.last_scenario)
+    rng = np.random.default_rng()
+
+    vrep.simxFinish(-1)
+    clientID = vrep.simxStart('127.0.0.1', 19997, True, True, -500000, 5)
+    if clientID == -1:
+        print('Failed connecting to remote API server')
+        return
+    emptyBuff = bytearray()
+    vrep.simxStartSimulation(clientID, vrep.simx_opmode_oneshot_wait)
+    res, robotHandle = vrep.simxGetObjectHandle(clientID, 'UR5#', vrep.simx_opmode_oneshot_wait)
+
+    collisionChecking = 1
+    minConfigsForPathPlanningPath = 400
+    searchCount = 1
+    regressions = []
+
+    for scenario_id, mapFile, start, goal in scenarios:
+        vrep.simxCallScriptFunction(clientID, 'remoteApiCommandServer', vrep.sim_scripttype_childscript, 'UpdateMap', [len(mapFile)], [], mapFile, emptyBuff, vrep.simx_opmode_oneshot_wait)
+        for name in names:
+            inInts = [robotHandle, collisionChecking, minConfigsForPathPlanningPath, searchCount, algorithms[name]]
+            times = []
+            checks = []
+            perRun = []
+            successes = 0
+            ci = (float('nan'), float('nan'))
+            while len(times) < args.max_runs:
+                seed, solved, planningTime, count, counts = runOnce(clientID, inInts, start + goal, cursor, connect)
+                if args.perf and counts is None:
+                    raise RuntimeError('no performance counters recorded; start V-REP with SIM_OMPL_PERF_COUNTERS=1 and check perf_event_paranoid')
+                times.append(planningTime)
+                checks.append(count)
+                if solved:
+                    successes += 1
+                cursor.execute('INSERT INTO results (scenario_id, algorithm_name, planning_time, edt_query_count, data_tag) VALUES (?,?,?,?,?)', (scenario_id, name, planningTime, count, args.tag))
+                cursor.execute('INSERT INTO benchmark_runs (experiment_id, data_tag, seed, solved, {}) VALUES (?,?,?,?,?,?,?,?)'.format(', '.join(counters)),
+                               (cursor.lastrowid, args.tag, seed, int(solved)) + tuple(counts if args.perf else [None] * len(counters)))
+                if args.perf and count > 0:
+                    perRun.append([c / float(count) for c in counts] + [counts[1] / float(counts[0]) if counts[0] else 0.0])
+                connect.commit()
+                if len(times) >= args.min_runs:
+                    median = np.median(times)
+                    ci = bootstrapMedianCI(times, args.confidence, args.resamples, rng)
+                    if median > 0 and (ci[1] - ci[0]) / median <= args.ci_width:
+                        break
+
+            median = float(np.median(times))
+            p10, p25, p75, p90 = np.percentile(times, [10, 25, 75, 90])
+            perCheck = list(np.median(perRun, axis=0)) if perRun else [None] * (len(counters) + 1)
+            cursor.execute('INSERT OR REPLACE INTO benchmark_summary (data_tag, scenario_id, algorithm_name, runs, success_rate, median_planning_time, ci_low, ci_high, p10, p25, p75, p90, avg_planning_time, std_planning_time, avg_validity_checks, {}, instructions_per_cycle) VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)'.format(', '.join(c + '_per_check' for c in counters)),
+                           (args.tag, scenario_id, name, len(times), successes / float(len(times)), median, ci[0], ci[1],
+                            p10, p25, p75, p90, float(np.mean(times)), float(np.std(times, ddof=1)) if len(times) > 1 else 0.0, float(np.mean(checks))) + tuple(perCheck))
+            connect.commit()
+            print("scenario {} {}: {} runs, success {:.0%}, median {:.4f}s [{:.4f}, {:.4f}], p90 {:.4f}s, {:.0f} checks".format(
+                scenario_id, name, len(times), successes / float(len(times)), median, ci[0], ci[1], p90, np.mean(checks)))
+            if perRun:
+                print("  per check: {:.0f} cycles, {:.0f} instructions, {:.1f} cache misses, {:.1f} branch misses; IPC {:.2f}".format(*perCheck))
+
+            if args.baseline:
+                cursor.execute('SELECT planning_time FROM results WHERE data_tag = ? AND scenario_id = ? AND algorithm_name = ?', (args.baseline, scenario_id, name))
+                baseline = [r[0] for r in cursor.fetchall()]
+                if len(baseline) >= 2:
+                    p = mannWhitneyU(times, baseline)
+                    ratio = median / np.median(baseline) if np.median(baseline) > 0 else float('inf')
+                    if p < args.significance:
+                        regressions.append((scenario_id, name, ratio, p))
+                        print("  SLOWDOWN vs {}: median x{:.2f} (p = {:.2g})".format(args.baseline, ratio, p))
+                    else:
+                        print("  vs {}: median x{:.2f} (p = {:.2g})".format(args.baseline, ratio, p))
+
+    vrep.simxStopSimulation(clientID, vrep.simx_opmode_oneshot_wait)
+    vrep.simxFinish(clientID)
+    connect.close()
+
+    if args.baseline:
+        print("{} significant slowdown(s) vs {}".format(len(regressions), args.baseline))
+        for scenario_id, name, ratio, p in regressions:
+            print("  scenario {} {}: x{:.2f} (p = {:.2g})".format(scenario_id, name, ratio, p))
+
+
+if __name__ == '__main__':
+    main()
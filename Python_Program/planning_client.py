@@ -0,0 +1,101 @@
+# Client of the planning server (server/planningServer.cpp), which plans
+# without V-REP, validating states with a native state validation function
+# (see nativeCallbacks.h). The protocol is described in server/protocol.h.
+#
+# Start the server, then run e.g.:
+#   python planning_client.py /tmp/ompl.sock ./libvalidity.so isValid \
+#       --bounds -3.14 3.14 --start 0 0 0 --goal 1 1 1
+
+import argparse
+import socket
+import struct
+
+CREATE_TASK = 1
+SOLVE = 2
+DESTROY_TASK = 3
+
+algorithms = {'RRT': 30018, 'RRTConnect': 30019, 'SBL': 30021}
+
+
+class PlanningError(Exception):
+    pass
+
+
+class PlanningClient(object):
+    def __init__(self, socketPath):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(socketPath)
+
+    def close(self):
+        self.sock.close()
+
+    def receive(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise PlanningError('connection closed by the server')
+            data += chunk
+        return data
+
+    def request(self, op, payload):
+        self.sock.sendall(struct.pack('=iI', op, len(payload)) + payload)
+        status, length = struct.unpack('=iI', self.receive(8))
+        response = self.receive(length)
+        if status != 0:
+            raise PlanningError(response.decode('utf-8', 'replace'))
+        return response
+
+    def createTask(self, algorithm, boundsLow, boundsHigh, library, function):
+        dim = len(boundsLow)
+        payload = struct.pack('=ii', algorithm, dim)
+        payload += struct.pack('={}d'.format(dim), *boundsLow) + struct.pack('={}d'.format(dim), *boundsHigh)
+        payload += library.encode() + b'\0' + function.encode() + b'\0'
+        return struct.unpack('=i', self.request(CREATE_TASK, payload))[0]
+
+    # returns the path as a list of states, or None if no solution was found
+    def solve(self, taskHandle, start, goal, maxTime, maxSimplificationTime=0.0):
+        dim = len(start)
+        payload = struct.pack('=idd', taskHandle, maxTime, maxSimplificationTime)
+        payload += struct.pack('={}d'.format(dim), *start) + struct.pack('={}d'.format(dim), *goal)
+        response = self.request(SOLVE, payload)
+        solved, stateCount = struct.unpack_from('=ii', response)
+        if not solved:
+            return None
+        values = struct.unpack_from('={}d'.format(stateCount * dim), response, 8)
+        return [list(values[i * dim:(i + 1) * dim]) for i in range(stateCount)]
+
+    def destroyTask(self, taskHandle):
+        self.request(DESTROY_TASK, struct.pack('=i', taskHandle))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Plans one query with the planning server')
+    parser.add_argument('socket', help='path of the server socket')
+    parser.add_argument('library', help='shared library of the native state validation function')
+    parser.add_argument('function', help='native state validation function')
+    parser.add_argument('--algorithm', default='RRTConnect', help='among ' + ', '.join(sorted(algorithms)))
+    parser.add_argument('--bounds', type=float, nargs=2, default=[-3.14, 3.14], help='bounds of every joint')
+    parser.add_argument('--start', type=float, nargs='+', required=True)
+    parser.add_argument('--goal', type=float, nargs='+', required=True)
+    parser.add_argument('--max-time', type=float, default=5.0)
+    parser.add_argument('--simplify', type=float, default=0.0, help='max simplification time (negative: until no improvement)')
+    args = parser.parse_args()
+
+    client = PlanningClient(args.socket)
+    dim = len(args.start)
+    taskHandle = client.createTask(algorithms[args.algorithm], [args.bounds[0]] * dim, [args.bounds[1]] * dim, args.library, args.function)
+    try:
+        path = client.solve(taskHandle, args.start, args.goal, args.max_time, args.simplify)
+        if path is None:
+            print('no solution found')
+        else:
+            for state in path:
+                print(' '.join('{:.6f}'.format(v) for v in state))
+    finally:
+        client.destroyTask(taskHandle)
+        client.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,158 @@
+#ifndef HEADLESS_SCENE_H_INCLUDED
+#define HEADLESS_SCENE_H_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "v_repLib.h"
+
+// Stand-in for the parts of the V-REP API used by the plugin's hot paths, so
+// that they can be benchmarked without a running simulator.
+//
+// The scene is a planar arm with one revolute joint per link, whose links are
+// bounding spheres, and a few spherical obstacles. Joint handles are
+// jointHandle(i), link handles linkHandle(i), obstacle handles
+// obstacleHandle(j).
+//
+// install() points the v_repLib.h function pointers at this scene (instead of
+// loading the simulator library); functions not listed there stay null.
+namespace headless
+{
+    struct Sphere
+    {
+        double x, y, z, radius;
+    };
+
+    struct Scene
+    {
+        double linkLength;
+        double linkRadius;
+        std::vector<double> joints;
+        std::vector<Sphere> obstacles;
+    };
+
+    Scene scene;
+
+    inline simInt jointHandle(int i) { return 100 + i; }
+    inline simInt linkHandle(int i) { return 200 + i; }
+    inline simInt obstacleHandle(int j) { return 300 + j; }
+
+    // bounding sphere of a link (at the middle of the link):
+    Sphere linkSphere(int link)
+    {
+        double x = 0, y = 0, angle = 0;
+        for(int i = 0; i <= link; i++)
+        {
+            angle += scene.joints[i];
+            double length = i == link ? scene.linkLength / 2 : scene.linkLength;
+            x += length * std::cos(angle);
+            y += length * std::sin(angle);
+        }
+        Sphere s = {x, y, 0.0, scene.linkRadius};
+        return s;
+    }
+
+    bool sphereOf(simInt handle, Sphere &s)
+    {
+        if(handle >= linkHandle(0) && handle < linkHandle(scene.joints.size()))
+        {
+            s = linkSphere(handle - linkHandle(0));
+            return true;
+        }
+        if(handle >= obstacleHandle(0) && handle < obstacleHandle(scene.obstacles.size()))
+        {
+            s = scene.obstacles[handle - obstacleHandle(0)];
+            return true;
+        }
+        return false;
+    }
+
+    simInt getJointPosition(simInt objectHandle, simFloat *position)
+    {
+        int i = objectHandle - jointHandle(0);
+        if(i < 0 || i >= (int)scene.joints.size()) return -1;
+        *position = (simFloat)scene.joints[i];
+        return 1;
+    }
+
+    simInt setJointPosition(simInt objectHandle, simFloat position)
+    {
+        int i = objectHandle - jointHandle(0);
+        if(i < 0 || i >= (int)scene.joints.size()) return -1;
+        scene.joints[i] = position;
+        return 1;
+    }
+
+    simInt checkCollision(simInt entity1Handle, simInt entity2Handle)
+    {
+        Sphere a, b;
+        if(!sphereOf(entity1Handle, a) || !sphereOf(entity2Handle, b)) return -1;
+        double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z, r = a.radius + b.radius;
+        return dx * dx + dy * dy + dz * dz < r * r ? 1 : 0;
+    }
+
+    // distance between the two spheres (0 if they overlap), with the closest
+    // points; like V-REP, returns 0 if the distance is above a positive
+    // threshold:
+    simInt checkDistance(simInt entity1Handle, simInt entity2Handle, simFloat threshold, simFloat *distanceData)
+    {
+        Sphere a, b;
+        if(!sphereOf(entity1Handle, a) || !sphereOf(entity2Handle, b)) return -1;
+        double d[3] = {b.x - a.x, b.y - a.y, b.z - a.z};
+        double centers = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        double distance = std::max(0.0, centers - a.radius - b.radius);
+        if(threshold > 0 && distance > threshold) return 0;
+        for(int j = 0; j < 3; j++)
+        {
+            double u = centers > 0 ? d[j] / centers : 0.0;
+            distanceData[j] = (simFloat)((j == 0 ? a.x : j == 1 ? a.y : a.z) + a.radius * u);
+            distanceData[3 + j] = (simFloat)((j == 0 ? b.x : j == 1 ? b.y : b.z) - b.radius * u);
+        }
+        distanceData[6] = (simFloat)distance;
+        return 1;
+    }
+
+    simInt getSimulationState()
+    {
+        return sim_simulation_stopped;
+    }
+
+    simInt isHandleValid(simInt generalObjectHandle, simInt generalObjectType)
+    {
+        Sphere s;
+        return sphereOf(generalObjectHandle, s) ? 1 : 0;
+    }
+
+    simInt addStatusbarMessage(const simChar *message)
+    {
+        return 1;
+    }
+
+    // builds an arm of the given number of links (each 1/numLinks long) and
+    // a ring of obstacles around it:
+    void install(int numLinks, int numObstacles)
+    {
+        scene.linkLength = 1.0 / numLinks;
+        scene.linkRadius = 0.4 * scene.linkLength;
+        scene.joints.assign(numLinks, 0.0);
+        scene.obstacles.clear();
+        for(int j = 0; j < numObstacles; j++)
+        {
+            double a = 2 * M_PI * (j + 0.5) / numObstacles;
+            Sphere s = {0.8 * std::cos(a), 0.8 * std::sin(a), 0.0, 0.1};
+            scene.obstacles.push_back(s);
+        }
+
+        simGetJointPosition = getJointPosition;
+        simSetJointPosition = setJointPosition;
+        simCheckCollision = checkCollision;
+        simCheckDistance = checkDistance;
+        simGetSimulationState = getSimulationState;
+        simIsHandleValid = isHandleValid;
+        simAddStatusbarMessage = addStatusbarMessage;
+    }
+}
+
+#endif // HEADLESS_SCENE_H_INCLUDED
@@ -0,0 +1,263 @@
+// Microbenchmarks of the plugin's hot paths, run against a headless stand-in
+// of the simulator (headlessScene.h) instead of V-REP.
+//
+// The plugin is compiled into this translation unit, so it needs the same
+// include paths and generated stubs as the plugin itself, e.g.:
+//
+//   g++ -O2 -std=c++11 -I. -I<build dir> -I$VREP/programming/include \
+//       -I$VREP/programming/v_repMath benchmarks/microbench.cpp \
+//       <build dir>/stubs.cpp $VREP/programming/common/v_repLib.cpp \
+//       -lompl -lsqlite3 -ldl -lpthread -o microbench
+//
+// Usage: microbench [filter] [min seconds per benchmark]
+// Prints, for each benchmark whose name contains filter, the time and number
+// of heap allocations per call.
+
+#include "../plugin.cpp"
+#include "headlessScene.h"
+
+#include <cstdio>
+#include <new>
+
+// counts heap allocations (of all threads):
+std::atomic<unsigned long> allocationCount(0);
+
+void * operator new(std::size_t size)
+{
+    allocationCount++;
+    if(void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+namespace bench
+{
+    const char *filter = "";
+    double minTime = 0.5;
+
+    // calls f repeatedly for at least minTime seconds and prints the time and
+    // allocations per call:
+    template<typename F>
+    void run(const char *name, F f)
+    {
+        if(!std::strstr(name, filter)) return;
+
+        for(int i = 0; i < 10; i++) f(); // warm up
+
+        size_t iterations = 0, batch = 1;
+        unsigned long allocations = allocationCount;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+        while(elapsed < minTime)
+        {
+            for(size_t i = 0; i < batch; i++) f();
+            iterations += batch;
+            batch *= 2;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        allocations = allocationCount - allocations;
+
+        std::printf("%-32s %12zu %14.1f %12.2f\n", name, iterations, elapsed * 1e9 / iterations, (double)allocations / iterations);
+    }
+
+    // goal of the native goal task: all joints at 1 rad
+    int nativeGoal(const double *state, int dim, double *distance)
+    {
+        double d = 0;
+        for(int i = 0; i < dim; i++)
+            d += (state[i] - 1.0) * (state[i] - 1.0);
+        *distance = std::sqrt(d);
+        return *distance < 1e-2;
+    }
+
+    // creates a task planning the joints of the headless arm; the collision
+    // pairs are all (link, obstacle) pairs:
+    simInt createArmTask(const char *name, int numLinks, int numObstacles)
+    {
+        createTask_in taskIn;
+        createTask_out taskOut;
+        taskIn.name = name;
+        createTask(nullptr, "createTask", &taskIn, &taskOut);
+
+        setStateSpace_in spaceIn;
+        setStateSpace_out spaceOut;
+        spaceIn.taskHandle = taskOut.taskHandle;
+        for(int i = 0; i < numLinks; i++)
+        {
+            createStateSpace_in in;
+            createStateSpace_out out;
+            in.name = std::string(name) + ".joint" + std::to_string(i);
+            in.type = sim_ompl_statespacetype_joint_position;
+            in.objectHandle = headless::jointHandle(i);
+            in.boundsLow.push_back(-M_PI);
+            in.boundsHigh.push_back(M_PI);
+            in.useForProjection = i < 2;
+            in.weight = 1.0;
+            in.refObjectHandle = -1;
+            createStateSpace(nullptr, "createStateSpace", &in, &out);
+            spaceIn.stateSpaceHandles.push_back(out.stateSpaceHandle);
+        }
+        setStateSpace(nullptr, "setStateSpace", &spaceIn, &spaceOut);
+
+        setCollisionPairs_in pairsIn;
+        setCollisionPairs_out pairsOut;
+        pairsIn.taskHandle = taskOut.taskHandle;
+        for(int i = 0; i < numLinks; i++)
+        {
+            for(int j = 0; j < numObstacles; j++)
+            {
+                pairsIn.collisionPairHandles.push_back(headless::linkHandle(i));
+                pairsIn.collisionPairHandles.push_back(headless::obstacleHandle(j));
+            }
+        }
+        setCollisionPairs(nullptr, "setCollisionPairs", &pairsIn, &pairsOut);
+
+        setStartState_in startIn;
+        setStartState_out startOut;
+        startIn.taskHandle = taskOut.taskHandle;
+        startIn.state.assign(numLinks, 0.0f);
+        setStartState(nullptr, "setStartState", &startIn, &startOut);
+
+        setGoalState_in goalIn;
+        setGoalState_out goalOut;
+        goalIn.taskHandle = taskOut.taskHandle;
+        goalIn.state.assign(numLinks, 1.0f);
+        setGoalState(nullptr, "setGoalState", &goalIn, &goalOut);
+
+        setAlgorithm_in algorithmIn;
+        setAlgorithm_out algorithmOut;
+        algorithmIn.taskHandle = taskOut.taskHandle;
+        algorithmIn.algorithm = sim_ompl_algorithm_RRTConnect;
+        setAlgorithm(nullptr, "setAlgorithm", &algorithmIn, &algorithmOut);
+
+        return taskOut.taskHandle;
+    }
+
+    void setupTask(simInt taskHandle)
+    {
+        setup_in in;
+        setup_out out;
+        in.taskHandle = taskHandle;
+        setup(nullptr, "setup", &in, &out);
+        getTask(taskHandle)->spaceInformationPtr->setup();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1) bench::filter = argv[1];
+    if(argc > 2) bench::minTime = std::atof(argv[2]);
+
+    const int numLinks = 6, numObstacles = 4;
+    headless::install(numLinks, numObstacles);
+
+    simInt taskHandle = bench::createArmTask("bench", numLinks, numObstacles);
+    bench::setupTask(taskHandle);
+    TaskDef *task = getTask(taskHandle);
+    const ob::SpaceInformationPtr &si = task->spaceInformationPtr;
+
+    std::printf("%-32s %12s %14s %12s\n", "benchmark", "iterations", "ns/call", "allocs/call");
+
+    bench::run("StateSpace construction", [&] {
+        ob::StateSpacePtr space(new StateSpace(task));
+    });
+
+    ob::ScopedState<ob::CompoundStateSpace> s(task->stateSpacePtr), s2(task->stateSpacePtr), s3(task->stateSpacePtr);
+    s.random();
+    s2.random();
+
+    bench::run("StateSpace::writeState", [&] {
+        task->stateSpacePtr->as<StateSpace>()->writeState(s);
+    });
+
+    bench::run("StateSpace::readState", [&] {
+        task->stateSpacePtr->as<StateSpace>()->readState(s3);
+    });
+
+    ob::StateSamplerPtr sampler = si->allocStateSampler();
+    std::vector<ob::State *> states(1024);
+    for(size_t i = 0; i < states.size(); i++)
+    {
+        states[i] = si->allocState();
+        sampler->sampleUniform(states[i]);
+    }
+    // cycles through the sampled states:
+    size_t next = 0;
+    auto at = [&](size_t i) { return states[i % states.size()]; };
+
+    bench::run("StateValidityChecker::isValid", [&] {
+        si->isValid(at(next++));
+    });
+
+    double dist;
+    bench::run("isValid with clearance", [&] {
+        si->getStateValidityChecker()->isValid(at(next++), dist);
+    });
+
+    ob::EuclideanProjection projection(task->projectionEvaluatorPtr->getDimension());
+    bench::run("ProjectionEvaluator::project", [&] {
+        task->projectionEvaluatorPtr->project(at(next++), projection);
+    });
+
+    bench::run("StateSpace::distance", [&] {
+        task->stateSpacePtr->distance(at(next), at(next + 1));
+        next++;
+    });
+
+    bench::run("StateSpace::interpolate", [&] {
+        task->stateSpacePtr->interpolate(at(next), at(next + 1), 0.5, s3.get());
+        next++;
+    });
+
+    bench::run("SpaceInformation::checkMotion", [&] {
+        si->checkMotion(at(next), at(next + 1));
+        next++;
+    });
+
+    // goal check, with a native goal function:
+    {
+        simInt goalTaskHandle = bench::createArmTask("benchGoal", numLinks, numObstacles);
+        TaskDef *goalTask = getTask(goalTaskHandle);
+        goalTask->goal.type = TaskDef::Goal::NATIVE;
+        goalTask->goal.nativeCallback.function = "nativeGoal";
+        goalTask->goal.nativeCallback.address = (void *)bench::nativeGoal;
+        bench::setupTask(goalTaskHandle);
+        const ob::GoalPtr &goal = goalTask->problemDefinitionPtr->getGoal();
+
+        bench::run("Goal::isSatisfied", [&] {
+            goal->isSatisfied(at(next++));
+        });
+    }
+
+    // export of a solution path and of the planner data:
+    if(task->planner->solve(5.0))
+    {
+        getPath_in pathIn;
+        pathIn.taskHandle = taskHandle;
+        bench::run("getPath", [&] {
+            getPath_out pathOut;
+            getPath(nullptr, "getPath", &pathIn, &pathOut);
+        });
+
+        getData_in dataIn;
+        dataIn.taskHandle = taskHandle;
+        bench::run("getData", [&] {
+            getData_out dataOut;
+            getData(nullptr, "getData", &dataIn, &dataOut);
+        });
+    }
+    else
+    {
+        std::printf("no solution found, skipping getPath/getData\n");
+    }
+
+    for(size_t i = 0; i < states.size(); i++)
+        si->freeState(states[i]);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef NATIVE_CALLBACKS_H_INCLUDED
+#define NATIVE_CALLBACKS_H_INCLUDED
+
+/*
+ * C interface for state validation, goal and valid state sampling functions
+ * compiled into a shared library, and registered on a task with the
+ * setStateValidationNative, setGoalNative and setValidStateSamplerNative
+ * commands (as an alternative to the Lua callbacks).
+ *
+ * States are passed as arrays of dim doubles, in the same order as the
+ * states used by the Lua API. Functions may be called concurrently by
+ * multithreaded planners, so they must be reentrant.
+ *
+ * A library must declare the version of this interface it was built for,
+ * by putting SIM_OMPL_NATIVE_ABI() once in one of its source files.
+ */
+
+#define SIM_OMPL_NATIVE_ABI_VERSION 1
+
+#ifdef __cplusplus
+#define SIM_OMPL_NATIVE_EXTERN_C extern "C"
+#else
+#define SIM_OMPL_NATIVE_EXTERN_C
+#endif
+
+#define SIM_OMPL_NATIVE_ABI() \
+    SIM_OMPL_NATIVE_EXTERN_C __attribute__((visibility("default"))) const int simOMPLNativeAbiVersion = SIM_OMPL_NATIVE_ABI_VERSION
+
+/* returns non-zero if the state is valid */
+typedef int (*simOMPLStateValidationFn)(const double *state, int dim);
+
+/* returns non-zero if the state satisfies the goal, and stores the distance to the goal in *distance */
+typedef int (*simOMPLGoalFn)(const double *state, int dim, double *distance);
+
+/* writes a valid state into state; returns non-zero on success */
+typedef int (*simOMPLValidStateSamplerFn)(double *state, int dim);
+
+/* writes a valid state within distance of near into state; returns non-zero on success */
+typedef int (*simOMPLValidStateSamplerNearFn)(double *state, const double *near, int dim, double distance);
+
+#endif /* NATIVE_CALLBACKS_H_INCLUDED */
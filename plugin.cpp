@@ -1,17 +1,48 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <sstream>
 #include <vector>
 #include <map>
 #include <string>
+#include <unordered_map>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <ompl/base/Goal.h>
+#include <ompl/base/MotionValidator.h>
+#include <ompl/base/goals/GoalSampleableRegion.h>
 #include <ompl/base/goals/GoalState.h>
 #include <ompl/base/goals/GoalStates.h>
 #include <ompl/base/ProjectionEvaluator.h>
 #include <ompl/base/StateSpace.h>
 #include <ompl/geometric/PathSimplifier.h>
 #include <ompl/base/samplers/UniformValidStateSampler.h>
+#include <ompl/base/samplers/MaximizeClearanceValidStateSampler.h>
+#include <ompl/base/samplers/ObstacleBasedValidStateSampler.h>
 
 #include <ompl/base/spaces/RealVectorStateSpace.h>
 #include <ompl/base/spaces/SE2StateSpace.h>
@@ -49,10 +80,15 @@
 #include "plugin.h"
 #include "stubs.h"
 #include "sqlite3.h"
+#include "nativeCallbacks.h"
 
 namespace ob = ompl::base;
 namespace og = ompl::geometric;
 size_t collision_count;
+const char *resultsDatabase = "/home/lamy/Desktop/OMPL_Compare_Task/VREP_Test_Maps/scenarios.db";
+
+class KinematicChain;
+class ValidSamplePool;
 
 struct LuaCallbackFunction
 {
@@ -62,6 +98,16 @@ struct LuaCallbackFunction
     simInt scriptId;
 };
 
+struct NativeCallbackFunction
+{
+    // path of the shared library the function is loaded from
+    std::string library;
+    // name of the function
+    std::string function;
+    // address of the function in the loaded library
+    void *address;
+};
+
 struct ObjectDefHeader
 {
     // internal handle of this object (used by the plugin):
@@ -108,7 +154,7 @@ struct TaskDef
     // goal can be specified in different ways:
     struct Goal
     {
-        enum {STATE, DUMMY_PAIR, CLLBACK} type;
+        enum {STATE, DUMMY_PAIR, CLLBACK, NATIVE} type;
         // goal ref. dummy:
         int refDummy;
         // goal metric:
@@ -121,26 +167,99 @@ struct TaskDef
         struct {simInt goalDummy, robotDummy;} dummyPair;
         // goal callback:
         LuaCallbackFunction callback;
+        // goal function (native):
+        NativeCallbackFunction nativeCallback;
     } goal;
     // state validation:
     struct StateValidation
     {
-        enum {DEFAULT, CLLBACK} type;
-        // state validation callback:
+        enum {DEFAULT, CLLBACK, BATCH_CLLBACK, NATIVE} type;
+        // state validation callback (receives one state, or a block of
+        // states if type is BATCH_CLLBACK):
         LuaCallbackFunction callback;
+        // state validation function (native):
+        NativeCallbackFunction nativeCallback;
     } stateValidation;
     // resolution at which state validity needs to be verified in order for a
     // motion between two states to be considered valid (specified as a
     // fraction of the space's extent)
     float stateValidityCheckingResolution;
+    // how motions between two states are validated (with conservative
+    // advancement, steps near obstacles are still one checking resolution
+    // long, so an obstacle thinner than a step can be missed, as with the
+    // discrete validation):
+    MotionValidationType motionValidationType;
+    // order in which the collision pairs are checked:
+    CollisionPairOrdering collisionPairOrdering;
+    // indices of the collision pairs, in checking order, and number of
+    // collisions found with each pair (during the last solve() call, or
+    // since the first run on the same map if seeded):
+    std::vector<size_t> collisionPairOrder;
+    std::vector<unsigned long> collisionPairHits;
+    // number of states sampled at setup() to find the robot self-collision
+    // pairs that never or always collide (0 = check all pairs):
+    int collisionPairAnalysisSamples;
+    // pairs found by that analysis, which are not checked:
+    std::vector<bool> collisionPairIgnored;
+    // whether setup() bounds the workspace of each object colliding with the
+    // obstacle map to check it only against the map triangles it can reach
+    // (> 0; the value used to be a number of samples and is otherwise
+    // unused), and the margin added around that bound:
+    int workspaceCullingSamples;
+    double workspaceCullingMargin;
+    // map shapes reduced to the triangles within those workspaces:
+    std::vector<simInt> culledMapShapes;
+    // number of convex hulls approximating each robot shape (0 = check the
+    // exact meshes), the margin they are inflated by, and whether they only
+    // serve to prove pairs free, everything else being checked with the exact
+    // meshes (on by default). Without that, proxies are approximate: an
+    // obstacle lying inside a hull without crossing its surface is not
+    // reported, even if it crosses the mesh:
+    int collisionProxyHullCount;
+    double collisionProxyMargin;
+    bool collisionProxyExactFallback;
+    // convex proxies built for this task, per shape, number of hulls and
+    // margin (reused by later setups, removed with the task):
+    std::map<std::pair<simInt, std::pair<int, double> >, simInt> collisionProxies;
+    // the collision pairs actually checked (with the map replaced by the
+    // culled map shapes and robot shapes by their convex proxies), and the
+    // same without the proxies:
+    std::vector<simInt> collisionPairCheckHandles;
+    std::vector<simInt> collisionPairExactHandles;
+    // local bounding boxes of the shapes of those pairs, read at setup():
+    std::map<simInt, std::vector<float> > shapeBoxes;
+    // number of coarse levels of detail of the obstacle map checked before
+    // the map itself (0 = none), and the margin they are inflated by:
+    int mapLevelsOfDetail;
+    double mapLevelsOfDetailMargin;
+    // for each collision pair, the robot shape whose bounding box is checked
+    // against those levels (-1 if none), and the map they were set up for:
+    std::vector<simInt> collisionPairLevelShapes;
+    uint64_t collisionPairLevelsMap;
     // state sampling:
     struct ValidStateSampling
     {
-        enum {DEFAULT, CLLBACK} type;
-        // state sampling callback:
+        enum {DEFAULT, CLLBACK, BATCH_CLLBACK, NATIVE} type;
+        // state sampling callback (returns one state, or a block of
+        // batchSize states if type is BATCH_CLLBACK):
         LuaCallbackFunction callback;
         // "near" state sampling callback:
         LuaCallbackFunction callbackNear;
+        // number of states requested to the batched callback:
+        int batchSize;
+        // state sampling functions (native):
+        NativeCallbackFunction nativeCallback;
+        NativeCallbackFunction nativeCallbackNear;
+        // built-in sampler used when type is DEFAULT:
+        ValidStateSamplerType samplerType;
+        // number of candidates the Gaussian and bridge-test samplers check
+        // as one block:
+        int candidateBatchSize;
+        // statistics of the built-in sampler (whichever samplerType) over
+        // the last solve() call:
+        std::atomic<unsigned long> calls;
+        std::atomic<unsigned long> accepted;
+        std::atomic<unsigned long> nanoseconds;
     } validStateSampling;
     // projection evaluation:
     struct ProjectionEvaluation
@@ -150,6 +269,11 @@ struct TaskDef
         LuaCallbackFunction callback;
         // size of the projection (for callback)
         int dim;
+        // size of the grid cells used by projection based planners
+        // (if empty, it is computed from the extent of the projection):
+        std::vector<simFloat> cellSizes;
+        // number of cells per projection dimension, when computing cell sizes:
+        int cellsPerDimension;
     } projectionEvaluation;
     // search algorithm to use:
     Algorithm algorithm;
@@ -168,268 +292,317 @@ struct TaskDef
     ob::ProblemDefinitionPtr problemDefinitionPtr;
     // planner
     ob::PlannerPtr planner;
+    // kinematic model of the robot dummy (for dummy pair goals)
+    std::shared_ptr<KinematicChain> robotDummyChain;
+    // algorithms to race in parallel (if empty, only algorithm is used); the
+    // validity checks of the default and Lua state validation serialize on
+    // the scene lock, so only native validation lets the planners actually
+    // run at the same time:
+    std::vector<Algorithm> portfolio;
+    // planners of the portfolio (created with the setup() command)
+    std::vector<ob::PlannerPtr> portfolioPlanners;
+    // index in portfolio of the planner which found the solution, or -1
+    int portfolioWinner;
+    // number of threads building the roadmap of PRM and PRMstar (1 = the
+    // planner's own construction), and number of milestones they add before
+    // the planner takes over:
+    int roadmapThreadCount;
+    int roadmapMilestoneCount;
+    // number of uniform samples FMT and BITstar get validated ahead of use,
+    // as one batch, while they search the previous batch (0 = no batches),
+    // and number of threads validating a batch:
+    int sampleBatchSize;
+    int sampleBatchThreadCount;
+    // whether the next batch is validated in the background (set during
+    // solve() only, see startSampleBatches):
+    std::atomic<bool> sampleBatchPrefetch;
+    // number of valid uniform samples kept ready by background threads
+    // during solve() for the default valid state sampler (0 = no pool), and
+    // number of those threads. They validate states like the planner does,
+    // so they only run in parallel with it and with each other with native
+    // state validation; other validation types serialize on the scene lock:
+    int validSamplePoolDepth;
+    int validSamplePoolThreadCount;
+    // the pool (created with the setup() command):
+    std::shared_ptr<ValidSamplePool> validSamplePool;
+    // conditions ending solve() besides maxTime (each one off if <= 0):
+    struct Termination
+    {
+        // number of evaluations of the termination condition by a planner
+        // (about one per iteration, more for planners checking it in inner
+        // loops too), counted per planner of a portfolio; the first planner
+        // to reach it ends the solve() call:
+        long iterations;
+        // number of exact solutions found:
+        int solutionCount;
+        // cost of the best solution at or below this:
+        double costThreshold;
+        // best cost improved by less than plateauTolerance (relative) over
+        // the last plateauWindow seconds:
+        double plateauWindow;
+        double plateauTolerance;
+        // the condition which ended the last solve() call ("time",
+        // "iterations", "solutions", "cost", "plateau", or "planner" if the
+        // planner returned by itself):
+        std::string reason;
+    } termination;
+    // number of state validity checks done during the last solve() call
+    // (those of the valid sample pool's threads are counted by the pool):
+    std::atomic<unsigned long> validityCheckCount;
+    // number of collision pair checks done during the last solve() call
+    // (including those of the valid sample pool's threads):
+    std::atomic<unsigned long> collisionCheckCount;
+    // Chrome trace file written after solve() and simplifyPath() (if empty,
+    // tracing is off):
+    std::string traceFile;
+    // duration of the last solve() call, in seconds:
+    double lastPlanningTime;
+    // estimated memory the planner data and solution path may use, in bytes,
+    // before the planner data is cleared after solve() (0 = unlimited):
+    long memoryBudget;
 };
 
-std::map<simInt, TaskDef *> tasks;
-std::map<simInt, StateSpaceDef *> statespaces;
-simInt nextTaskHandle = 1000;
-simInt nextStateSpaceHandle = 9000;
-
-// this function will be called at simulation end to destroy objects that
-// were created during simulation, which otherwise would leak indefinitely:
-template<typename T>
-void destroyTransientObjects(std::map<simInt, T *>& c)
+// serializes access to the scene and to Lua (which are not thread safe) when
+// validity checking, goal checking, projection or sampling run in parallel
+// (e.g. portfolio planning); recursive, as Lua callbacks can call back into
+// the plugin (e.g. isStateValid):
+std::recursive_mutex sceneMutex;
+
+// timeline of the planning phases, written as a Chrome trace-event JSON file
+// (viewable in chrome://tracing or Perfetto). Each thread records into its
+// own ring buffer without locking; the buffers are only read once the
+// planner threads are done. When tracing is off, a Scope costs one relaxed
+// atomic load.
+namespace trace
 {
-    std::vector<simInt> transientObjects;
-
-    for(typename std::map<simInt, T *>::const_iterator it = c.begin(); it != c.end(); ++it)
+    struct Event
     {
-        if(it->second->header.destroyAfterSimulationStop)
-            transientObjects.push_back(it->first);
-    }
+        const char *name;
+        int64_t start; // ns since begin()
+        int64_t duration; // ns
+    };
 
-    for(size_t i = 0; i < transientObjects.size(); i++)
+    struct Buffer
     {
-        simInt key = transientObjects[i];
-        T *t = c[key];
-        c.erase(key);
-        delete t;
-    }
-}
-
-void destroyTransientObjects()
-{
-    destroyTransientObjects(tasks);
-    destroyTransientObjects(statespaces);
-}
-
-class ProjectionEvaluator : public ob::ProjectionEvaluator
-{
-public:
-    ProjectionEvaluator(const ob::StateSpacePtr& space, TaskDef *task)
-        : ob::ProjectionEvaluator(space), statespace(space)
+        static const size_t capacity = 1 << 16;
+        Event events[capacity];
+        // number of events recorded since begin() (older ones are overwritten):
+        std::atomic<size_t> count;
+        int tid;
+        // set when the thread exits; the buffer is kept (simplifyPath()
+        // appends to the trace of the last solve()) until the next begin():
+        std::atomic<bool> exited;
+    };
+
+    // owns the buffer of a thread, and marks it when the thread exits:
+    struct ThreadBuffer
     {
-        this->task = task;
+        std::shared_ptr<Buffer> buffer;
 
-        dim = 0;
-
-        switch(task->projectionEvaluation.type)
+        ~ThreadBuffer()
         {
-        case TaskDef::ProjectionEvaluation::DEFAULT:
-            switch(task->goal.type)
-            {
-            case TaskDef::Goal::STATE:
-            case TaskDef::Goal::CLLBACK:
-                dim = defaultProjectionSize();
-                break;
-            case TaskDef::Goal::DUMMY_PAIR:
-                dim = dummyPairProjectionSize();
-                break;
-            default:
-                // this will never happen
-                dim = 0;
-                break;
-            }
-            break;
-        case TaskDef::ProjectionEvaluation::CLLBACK:
-            dim = luaProjectCallbackSize();
-            break;
-        default:
-            // this will never happen
-            dim = 0;
-            break;
+            if(buffer) buffer->exited = true;
         }
-    }
-
-    virtual unsigned int getDimension(void) const
+    };
+
+    std::atomic<bool> enabled(false);
+    std::chrono::steady_clock::time_point origin;
+    // buffers of the threads that recorded something (a thread registers its
+    // buffer once; the buffers of exited threads are dropped by begin()):
+    std::mutex buffersMutex;
+    std::vector<std::shared_ptr<Buffer> > buffers;
+    int nextTid = 0;
+
+    // drops the buffers of the threads that have exited (call with
+    // buffersMutex locked):
+    void pruneExited()
     {
-        return dim;
+        size_t n = 0;
+        for(size_t i = 0; i < buffers.size(); i++)
+        {
+            if(!buffers[i]->exited)
+                buffers[n++] = buffers[i];
+        }
+        buffers.resize(n);
     }
 
-    virtual void defaultCellSizes(void)
+    inline int64_t now()
     {
-        // TODO: handle this in the plugin API
-        cellSizes_.resize(dim);
-        for(int i = 0; i < dim; i++)
-            cellSizes_[i] = 0.05;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
     }
 
-    virtual void project(const ob::State *state, ob::EuclideanProjection& projection) const
+    Buffer * threadBuffer()
     {
-        for(int i = 0; i < dim; i++)
-            projection(i) = 0.0;
-
-        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
-
-        switch(task->projectionEvaluation.type)
+        static thread_local ThreadBuffer threadBuffer;
+        std::shared_ptr<Buffer> &buffer = threadBuffer.buffer;
+        if(!buffer)
         {
-        case TaskDef::ProjectionEvaluation::DEFAULT:
-            switch(task->goal.type)
-            {
-            case TaskDef::Goal::STATE:
-            case TaskDef::Goal::CLLBACK:
-                defaultProjection(state, projection);
-                break;
-            case TaskDef::Goal::DUMMY_PAIR:
-                dummyPairProjection(state, projection);
-                break;
-            }
-            break;
-        case TaskDef::ProjectionEvaluation::CLLBACK:
-            luaProjectCallback(state, projection);
-            break;
+            buffer = std::make_shared<Buffer>();
+            buffer->count = 0;
+            buffer->exited = false;
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffer->tid = nextTid++;
+            buffers.push_back(buffer);
         }
+        return buffer.get();
     }
 
-protected:
-    virtual int defaultProjectionSize() const
+    void record(const char *name, int64_t start, int64_t duration)
     {
-        for(size_t i = 0; i < task->stateSpaces.size(); i++)
-        {
-            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
-
-            if(!stateSpace->defaultProjection) continue;
-
-            switch(stateSpace->type)
-            {
-            case sim_ompl_statespacetype_pose2d:
-            case sim_ompl_statespacetype_position2d:
-                return 2;
-            case sim_ompl_statespacetype_pose3d:
-            case sim_ompl_statespacetype_position3d:
-                return 3;
-            case sim_ompl_statespacetype_joint_position:
-                return 1;
-            case sim_ompl_statespacetype_dubins:
-                return 2;
-            }
-        }
-
-        return 0;
+        Buffer *b = threadBuffer();
+        size_t n = b->count.load(std::memory_order_relaxed);
+        Event &e = b->events[n % Buffer::capacity];
+        e.name = name;
+        e.start = start;
+        e.duration = duration;
+        b->count.store(n + 1, std::memory_order_release);
     }
 
-    virtual void defaultProjection(const ob::State *state, ob::EuclideanProjection& projection) const
+    // records the lifetime of the object as a complete ("X") event:
+    class Scope
     {
-        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+    public:
+        Scope(const char *name)
+            : name(enabled.load(std::memory_order_relaxed) ? name : nullptr)
+        {
+            if(this->name) start = now();
+        }
 
-        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        ~Scope()
         {
-            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+            if(name) record(name, start, now() - start);
+        }
 
-            if(!stateSpace->defaultProjection) continue;
+    private:
+        const char *name;
+        int64_t start;
+    };
 
-            switch(stateSpace->type)
-            {
-            case sim_ompl_statespacetype_pose2d:
-                projection(0) = s->as<ob::SE2StateSpace::StateType>(i)->getX();
-                projection(1) = s->as<ob::SE2StateSpace::StateType>(i)->getY();
-                break;
-            case sim_ompl_statespacetype_pose3d:
-                projection(0) = s->as<ob::SE3StateSpace::StateType>(i)->getX();
-                projection(1) = s->as<ob::SE3StateSpace::StateType>(i)->getY();
-                projection(2) = s->as<ob::SE3StateSpace::StateType>(i)->getZ();
-                break;
-            case sim_ompl_statespacetype_position2d:
-                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
-                projection(1) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[1];
-                break;
-            case sim_ompl_statespacetype_position3d:
-                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
-                projection(1) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[1];
-                projection(2) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[2];
-                break;
-            case sim_ompl_statespacetype_joint_position:
-                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
-                break;
-            case sim_ompl_statespacetype_dubins:
-                projection(0) = s->as<ob::SE2StateSpace::StateType>(i)->getX();
-                projection(1) = s->as<ob::SE2StateSpace::StateType>(i)->getY();
-                break;
-            }
+    // discards previously recorded events (and the buffers of the threads
+    // that have exited since) and starts recording:
+    void begin()
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        pruneExited();
+        for(size_t i = 0; i < buffers.size(); i++)
+            buffers[i]->count = 0;
+        origin = std::chrono::steady_clock::now();
+        enabled = true;
+    }
 
-            break;
-        }
+    // continues recording after a dump, keeping the events recorded so far:
+    void resume()
+    {
+        if(origin == std::chrono::steady_clock::time_point())
+            begin();
+        enabled = true;
     }
 
-    virtual int dummyPairProjectionSize() const
+    // stops recording and writes all recorded events to filename:
+    void dump(const std::string &filename)
     {
-        /*
-        return 3;
-        */
-        int s = 0;
-        for(int i = 0; i < 3; i++)
+        enabled = false;
+
+        std::ofstream f(filename.c_str());
+        if(!f)
+            throw std::string("Cannot write trace file ") + filename;
+        f << std::fixed << std::setprecision(3);
+
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        f << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        bool first = true;
+        size_t dropped = 0;
+        for(size_t i = 0; i < buffers.size(); i++)
         {
-            if(task->goal.metric[i] != 0.0)
-                s++;
+            const Buffer *b = buffers[i].get();
+            size_t n = b->count.load(std::memory_order_acquire);
+            size_t from = n > Buffer::capacity ? n - Buffer::capacity : 0;
+            dropped += from;
+            for(size_t j = from; j < n; j++)
+            {
+                const Event &e = b->events[j % Buffer::capacity];
+                f << (first ? "" : ",") << std::endl
+                    << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+                    << ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << e.duration / 1000.0 << "}";
+                first = false;
+            }
         }
-        if(s == 0)
-            s = 1; // if X/Y/Z are ignored
-        return s;
+        f << std::endl << "], \"otherData\": {\"droppedEvents\": " << dropped << "}}" << std::endl;
     }
+}
 
-    virtual void dummyPairProjection(const ob::State *state, ob::EuclideanProjection& projection) const
-    {
-        /*
-        simFloat pos[3];
-        simGetObjectPosition(task->goal.dummyPair.robotDummy, -1, &pos[0]);
-        projection(0) = pos[0];
-        projection(1) = pos[1];
-        projection(2) = pos[2];
-        */
+std::map<simInt, TaskDef *> tasks;
+std::map<simInt, StateSpaceDef *> statespaces;
+simInt nextTaskHandle = 1000;
+simInt nextStateSpaceHandle = 9000;
 
-        // TODO: don't we need to apply the provided state to the robot, read the tip dummy's position, then project it?
+// removes the shapes a task added to the scene (culled maps, convex proxies;
+// defined after those):
+void removeSceneObjects(TaskDef *task);
 
-        // do projection, only for axis that should not be ignored:
-        simFloat pos[3];
-        simGetObjectPosition(task->goal.dummyPair.robotDummy, task->goal.refDummy, &pos[0]);
-        int ind = 0;
-        for(int i = 0; i < 3; i++)
-        {
-            if(task->goal.metric[i] != 0.0)
-                projection(ind++) = pos[i];
-        }
-        if(ind == 0)
-            projection(0) = 0.0; // if X/Y/Z are ignored
+inline void removeSceneObjects(StateSpaceDef *statespace)
+{
+}
 
-        // TODO: restore original state, no?
-    }
+// this function will be called at simulation end to destroy objects that
+// were created during simulation, which otherwise would leak indefinitely:
+template<typename T>
+void destroyTransientObjects(std::map<simInt, T *>& c)
+{
+    std::vector<simInt> transientObjects;
 
-    virtual int luaProjectCallbackSize() const
+    for(typename std::map<simInt, T *>::const_iterator it = c.begin(); it != c.end(); ++it)
     {
-        return task->projectionEvaluation.dim;
+        if(it->second->header.destroyAfterSimulationStop)
+            transientObjects.push_back(it->first);
     }
 
-    virtual void luaProjectCallback(const ob::State *state, ob::EuclideanProjection& projection) const
+    for(size_t i = 0; i < transientObjects.size(); i++)
     {
-        std::vector<double> stateVec;
-        statespace->copyToReals(stateVec, state);
+        simInt key = transientObjects[i];
+        T *t = c[key];
+        c.erase(key);
+        removeSceneObjects(t);
+        delete t;
+    }
+}
 
-        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+void destroyTransientObjects()
+{
+    destroyTransientObjects(tasks);
+    destroyTransientObjects(statespaces);
+}
 
-        projectionEvaluationCallback_in in_args;
-        projectionEvaluationCallback_out out_args;
+// forwards to the state space's default sampler, recording each sample in
+// the trace (installed only on tasks that have a trace file):
+class TracedStateSampler : public ob::StateSampler
+{
+public:
+    TracedStateSampler(const ob::StateSpace *space, const ob::StateSamplerPtr &sampler)
+        : ob::StateSampler(space), sampler(sampler)
+    {
+    }
 
-        for(size_t i = 0; i < stateVec.size(); i++)
-            in_args.state.push_back((float)stateVec[i]);
+    virtual void sampleUniform(ob::State *state)
+    {
+        trace::Scope scope("sampleUniform");
+        sampler->sampleUniform(state);
+    }
 
-        if(projectionEvaluationCallback(task->projectionEvaluation.callback.scriptId, task->projectionEvaluation.callback.function.c_str(), &in_args, &out_args))
-        {
-            for(size_t i = 0; i < out_args.projection.size(); i++)
-            {
-                projection(i) = out_args.projection[i];
-                std::cout << (i ? ", " : "") << out_args.projection[i];
-            }
-            std::cout << std::endl;
-        }
-        else
-        {
-            throw ompl::Exception("Projection evaluation callback " + task->projectionEvaluation.callback.function + " returned an error");
-        }
+    virtual void sampleUniformNear(ob::State *state, const ob::State *near, double distance)
+    {
+        trace::Scope scope("sampleUniformNear");
+        sampler->sampleUniformNear(state, near, distance);
     }
 
-    TaskDef *task;
-    const ob::StateSpacePtr& statespace;
-    int dim;
+    virtual void sampleGaussian(ob::State *state, const ob::State *mean, double stdDev)
+    {
+        trace::Scope scope("sampleGaussian");
+        sampler->sampleGaussian(state, mean, stdDev);
+    }
+
+protected:
+    ob::StateSamplerPtr sampler;
 };
 
 class StateSpace : public ob::CompoundStateSpace
@@ -510,9 +683,13 @@ public:
         }
     }
 
+    // (defined after the BatchValidatingStateSampler class)
+    virtual ob::StateSamplerPtr allocDefaultStateSampler() const;
+
     // writes state s to V-REP:
     void writeState(const ob::ScopedState<ob::CompoundStateSpace>& s)
     {
+        trace::Scope scope("writeState");
         int j = 0;
         simFloat pos[3], orient[4], value;
 
@@ -574,6 +751,7 @@ public:
     // reads state s from V-REP:
     void readState(ob::ScopedState<ob::CompoundStateSpace>& s)
     {
+        trace::Scope scope("readState");
         simFloat pos[3], orient[4], value;
 
         for(size_t i = 0; i < task->stateSpaces.size(); i++)
@@ -626,103 +804,2432 @@ protected:
     TaskDef *task;
 };
 
-class StateValidityChecker : public ob::StateValidityChecker
+// returns true if the pose of the given object changes when a state is
+// written to the scene, i.e. if it is (or is attached to) the object of
+// one of the task's state space components:
+bool isMovedByState(const TaskDef *task, simInt handle)
 {
-public:
-    StateValidityChecker(const ob::SpaceInformationPtr &si, TaskDef *task)
-        : ob::StateValidityChecker(si), statespace(si->getStateSpace()), task(task)
+    for(simInt o = handle; o != -1; o = simGetObjectParent(o))
     {
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            if(statespaces[task->stateSpaces[i]]->objectHandle == o)
+                return true;
+        }
+    }
+    return false;
+}
+
+// cache of obstacle maps loaded from STL files: each file is parsed once (in
+// parallel), its vertices are deduplicated, and the resulting mesh is stored
+// in <STL directory>/.mapcache/<content hash>.mesh. Later loads of the same
+// content map that file into memory instead of parsing the STL again, and
+// reloading the map that is already in the scene reuses its shape (and the
+// collision structures V-REP has built for it).
+namespace mapcache
+{
+    const char magic[8] = {'O', 'M', 'P', 'L', 'M', 'A', 'P', '\0'};
+    const uint32_t version = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexCount; // number of vertices (3 floats each)
+        uint64_t hash; // of the STL file
+        uint32_t indexCount; // number of indices (3 per triangle)
+        uint32_t reserved;
+    };
+
+    // a cache file mapped in memory (or, if it couldn't be stored, the same
+    // layout in a heap block):
+    struct Mesh
+    {
+        void *data;
+        size_t size;
+        bool mapped;
+
+        const Header * header() const { return (const Header *)data; }
+        const float * vertices() const { return (const float *)(header() + 1); }
+        const int32_t * indices() const { return (const int32_t *)(vertices() + 3 * header()->vertexCount); }
+    };
+
+    std::map<uint64_t, Mesh> meshes;
+    uint64_t currentHash = 0;
+    simInt currentShape = -1;
+    // coarse levels of detail of the current map (coarsest first, see
+    // buildMapLevels), as lists of boxes (min x, y, z, max x, y, z), and the
+    // margin they were built with:
+    std::vector<std::vector<float> > currentLevels;
+    double currentLevelsMargin = 0.0;
+
+    uint64_t fnv1a(const unsigned char *data, size_t size)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for(size_t i = 0; i < size; i++)
+        {
+            h ^= data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // reads all the triangle corners of a binary or ASCII STL, 9 floats per
+    // triangle; binary files are split among threads:
+    void parseSTL(const std::string &filename, const std::vector<unsigned char> &file, std::vector<float> &corners)
+    {
+        uint32_t triangles = 0;
+        if(file.size() >= 84)
+            std::memcpy(&triangles, &file[80], 4);
+
+        if(file.size() >= 84 && file.size() == 84 + 50 * (size_t)triangles)
+        {
+            corners.resize(9 * (size_t)triangles);
+            unsigned int numThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), triangles / 10000 + 1));
+            std::vector<std::thread> threads;
+            for(unsigned int t = 0; t < numThreads; t++)
+            {
+                threads.push_back(std::thread([&, t] {
+                    size_t from = (size_t)triangles * t / numThreads, to = (size_t)triangles * (t + 1) / numThreads;
+                    for(size_t i = from; i < to; i++)
+                        std::memcpy(&corners[9 * i], &file[84 + 50 * i + 12], 36); // skip the normal
+                }));
+            }
+            for(size_t t = 0; t < threads.size(); t++)
+                threads[t].join();
+            return;
+        }
+
+        // ASCII: every "vertex x y z" line is a corner
+        std::istringstream s(std::string(file.begin(), file.end()));
+        std::string word;
+        while(s >> word)
+        {
+            if(word != "vertex") continue;
+            float v[3];
+            if(!(s >> v[0] >> v[1] >> v[2]))
+                throw std::string("Malformed STL file ") + filename + ".";
+            corners.insert(corners.end(), v, v + 3);
+        }
+        if(corners.empty() || corners.size() % 9 != 0)
+            throw std::string("STL file ") + filename + " has no triangles or is malformed.";
+    }
+
+    // merges identical corners into shared vertices:
+    void deduplicate(const std::vector<float> &corners, std::vector<float> &vertices, std::vector<int32_t> &indices)
+    {
+        struct Key
+        {
+            uint32_t v[3];
+            bool operator==(const Key &o) const { return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2]; }
+        };
+        struct KeyHash
+        {
+            size_t operator()(const Key &k) const { return (k.v[0] * 73856093u) ^ (k.v[1] * 19349663u) ^ (k.v[2] * 83492791u); }
+        };
+
+        std::unordered_map<Key, int32_t, KeyHash> index;
+        index.reserve(corners.size() / 9);
+        indices.resize(corners.size() / 3);
+        for(size_t i = 0; i < indices.size(); i++)
+        {
+            Key k;
+            std::memcpy(k.v, &corners[3 * i], sizeof(k.v));
+            std::pair<std::unordered_map<Key, int32_t, KeyHash>::iterator, bool> r = index.insert(std::make_pair(k, (int32_t)(vertices.size() / 3)));
+            if(r.second)
+                vertices.insert(vertices.end(), &corners[3 * i], &corners[3 * i] + 3);
+            indices[i] = r.first->second;
+        }
+    }
+
+    bool mapFile(const std::string &path, uint64_t hash, Mesh &mesh)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+        {
+            ::close(fd);
+            return false;
+        }
+        mesh.size = st.st_size;
+        mesh.mapped = true;
+        mesh.data = mmap(nullptr, mesh.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mesh.data == MAP_FAILED)
+            return false;
+
+        const Header *h = mesh.header();
+        if(std::memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version || h->hash != hash
+                || mesh.size != sizeof(Header) + 12 * (size_t)h->vertexCount + 4 * (size_t)h->indexCount)
+        {
+            munmap(mesh.data, mesh.size);
+            return false;
+        }
+        return true;
+    }
+
+    Header makeHeader(uint64_t hash, const std::vector<float> &vertices, const std::vector<int32_t> &indices)
+    {
+        Header h;
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.vertexCount = vertices.size() / 3;
+        h.hash = hash;
+        h.indexCount = indices.size();
+        h.reserved = 0;
+        return h;
+    }
+
+    // returns false if the cache file can't be written (e.g. read-only
+    // directory):
+    bool writeFile(const std::string &path, uint64_t hash, const std::vector<float> &vertices, const std::vector<int32_t> &indices)
+    {
+        Header h = makeHeader(hash, vertices, indices);
+
+        // write to a temporary file first, so that a cache file is always complete:
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp.c_str(), std::ios::binary);
+            f.write((const char *)&h, sizeof(h));
+            f.write((const char *)vertices.data(), vertices.size() * sizeof(float));
+            f.write((const char *)indices.data(), indices.size() * sizeof(int32_t));
+            if(!f)
+            {
+                f.close();
+                unlink(tmp.c_str());
+                return false;
+            }
+        }
+        if(rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // the cache layout in a heap block, for maps whose cache can't be stored:
+    Mesh inMemory(uint64_t hash, const std::vector<float> &vertices, const std::vector<int32_t> &indices)
+    {
+        Header h = makeHeader(hash, vertices, indices);
+        Mesh mesh;
+        mesh.mapped = false;
+        mesh.size = sizeof(h) + vertices.size() * sizeof(float) + indices.size() * sizeof(int32_t);
+        mesh.data = std::malloc(mesh.size);
+        if(!mesh.data)
+            throw std::string("Out of memory loading map.");
+        char *p = (char *)mesh.data;
+        std::memcpy(p, &h, sizeof(h));
+        std::memcpy(p + sizeof(h), vertices.data(), vertices.size() * sizeof(float));
+        std::memcpy(p + sizeof(h) + vertices.size() * sizeof(float), indices.data(), indices.size() * sizeof(int32_t));
+        return mesh;
+    }
+
+    const Mesh & load(const std::string &filename, uint64_t hash, const std::vector<unsigned char> &file)
+    {
+        std::map<uint64_t, Mesh>::const_iterator it = meshes.find(hash);
+        if(it != meshes.end())
+            return it->second;
+
+        std::string dir = filename.substr(0, filename.find_last_of('/') + 1) + ".mapcache";
+        std::stringstream path;
+        path << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".mesh";
+
+        Mesh mesh;
+        if(!mapFile(path.str(), hash, mesh))
+        {
+            std::vector<float> corners, vertices;
+            std::vector<int32_t> indices;
+            parseSTL(filename, file, corners);
+            deduplicate(corners, vertices, indices);
+            mkdir(dir.c_str(), 0755);
+            if(!writeFile(path.str(), hash, vertices, indices) || !mapFile(path.str(), hash, mesh))
+            {
+                simAddStatusbarMessage(("OMPL: cannot store map cache file " + path.str() + ", using the parsed map.").c_str());
+                mesh = inMemory(hash, vertices, indices);
+            }
+        }
+        return meshes[hash] = mesh;
+    }
+
+    void unload()
+    {
+        for(std::map<uint64_t, Mesh>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+        {
+            if(it->second.mapped)
+                munmap(it->second.data, it->second.size);
+            else
+                std::free(it->second.data);
+        }
+        meshes.clear();
+        currentShape = -1;
+        currentLevels.clear();
+    }
+}
+
+// resets the order in which collision pairs are checked (leaving out the
+// ignored pairs) and their hit counts:
+void resetCollisionPairOrder(TaskDef *task)
+{
+    size_t n = task->collisionPairHandles.size() / 2;
+    task->collisionPairIgnored.resize(n, false);
+    task->collisionPairOrder.clear();
+    for(size_t i = 0; i < n; i++)
+    {
+        if(!task->collisionPairIgnored[i])
+            task->collisionPairOrder.push_back(i);
+    }
+    task->collisionPairHits.assign(n, 0);
+}
+
+// results of classifyCollisionPairs, per robot (collision pairs and state
+// space components with their bounds) and number of samples:
+std::map<std::string, std::vector<bool> > collisionPairAnalysisCache;
+
+// finds the collision pairs between two parts of the robot (both moved by
+// the state) that never collide, or always collide, in a number of random
+// states, and marks them as ignored. Pairs involving anything not moved by
+// the state (e.g. the map) are always checked. Being sampling based, a pair
+// that collides only in a tiny part of the state space may be missed, so
+// the number of samples should be large.
+void classifyCollisionPairs(TaskDef *task)
+{
+    size_t n = task->collisionPairHandles.size() / 2;
+    task->collisionPairIgnored.assign(n, false);
+
+    if(task->collisionPairAnalysisSamples > 0)
+    {
+        std::vector<size_t> robotPairs;
+        std::stringstream key;
+        for(size_t i = 0; i < n; i++)
+        {
+            simInt a = task->collisionPairHandles[2 * i + 0], b = task->collisionPairHandles[2 * i + 1];
+            key << a << "," << b << ";";
+            if(a >= 0 && b >= 0 && isMovedByState(task, a) && isMovedByState(task, b))
+                robotPairs.push_back(i);
+        }
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+            key << "|" << stateSpace->type << ":" << stateSpace->objectHandle << ":" << stateSpace->refFrameHandle;
+            for(size_t j = 0; j < stateSpace->boundsLow.size(); j++)
+                key << ":" << stateSpace->boundsLow[j] << ":" << stateSpace->boundsHigh[j];
+        }
+        key << "|" << task->collisionPairAnalysisSamples;
+
+        std::map<std::string, std::vector<bool> >::const_iterator it = collisionPairAnalysisCache.find(key.str());
+        if(it != collisionPairAnalysisCache.end())
+        {
+            task->collisionPairIgnored = it->second;
+        }
+        else if(!robotPairs.empty())
+        {
+            std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+            StateSpace *space = task->stateSpacePtr->as<StateSpace>();
+            ob::StateSamplerPtr sampler = task->stateSpacePtr->allocDefaultStateSampler();
+            ob::ScopedState<ob::CompoundStateSpace> s(task->stateSpacePtr), s_old(task->stateSpacePtr);
+            space->readState(s_old);
+
+            std::vector<int> hits(robotPairs.size(), 0);
+            for(int k = 0; k < task->collisionPairAnalysisSamples; k++)
+            {
+                sampler->sampleUniform(s.get());
+                space->writeState(s);
+                for(size_t j = 0; j < robotPairs.size(); j++)
+                {
+                    size_t i = robotPairs[j];
+                    if(simCheckCollision(task->collisionPairHandles[2 * i + 0], task->collisionPairHandles[2 * i + 1]) > 0)
+                        hits[j]++;
+                }
+            }
+
+            space->writeState(s_old);
+
+            for(size_t j = 0; j < robotPairs.size(); j++)
+                task->collisionPairIgnored[robotPairs[j]] = hits[j] == 0 || hits[j] == task->collisionPairAnalysisSamples;
+            collisionPairAnalysisCache[key.str()] = task->collisionPairIgnored;
+        }
+
+        if(task->verboseLevel >= 1)
+        {
+            std::stringstream s;
+            s << "OMPL: " << std::count(task->collisionPairIgnored.begin(), task->collisionPairIgnored.end(), true) << " of " << n << " collision pairs never or always collide and will not be checked.";
+            simAddStatusbarMessage(s.str().c_str());
+        }
+    }
+
+    resetCollisionPairOrder(task);
+}
+
+void removeCulledMapShapes(TaskDef *task)
+{
+    for(size_t i = 0; i < task->culledMapShapes.size(); i++)
+    {
+        if(simIsHandleValid(task->culledMapShapes[i], sim_appobj_object_type) > 0)
+            simRemoveObject(task->culledMapShapes[i]);
+    }
+    task->culledMapShapes.clear();
+}
+
+void removeCollisionProxies(TaskDef *task)
+{
+    for(std::map<std::pair<simInt, std::pair<int, double> >, simInt>::iterator it = task->collisionProxies.begin(); it != task->collisionProxies.end(); ++it)
+    {
+        if(simIsHandleValid(it->second, sim_appobj_object_type) > 0)
+            simRemoveObject(it->second);
+    }
+    task->collisionProxies.clear();
+}
+
+void removeSceneObjects(TaskDef *task)
+{
+    removeCulledMapShapes(task);
+    removeCollisionProxies(task);
+}
+
+// bounding box of a shape, in its own frame:
+void shapeLocalBox(simInt shape, simFloat local[6])
+{
+    static const simInt bboxParams[6] = {
+        sim_objfloatparam_objbbox_min_x, sim_objfloatparam_objbbox_min_y, sim_objfloatparam_objbbox_min_z,
+        sim_objfloatparam_objbbox_max_x, sim_objfloatparam_objbbox_max_y, sim_objfloatparam_objbbox_max_z
+    };
+
+    for(int j = 0; j < 6; j++)
+    {
+        local[j] = 0;
+        simGetObjectFloatParameter(shape, bboxParams[j], &local[j]);
+    }
+}
+
+// grows a world bounding box to contain a box given in the frame of the
+// matrix m (as returned by simGetObjectMatrix):
+void growBoundingBox(const simFloat local[6], const simFloat m[12], float bbox[6])
+{
+    for(int c = 0; c < 8; c++)
+    {
+        simFloat p[3] = {local[(c & 1) ? 3 : 0], local[(c & 2) ? 4 : 1], local[(c & 4) ? 5 : 2]};
+        for(int j = 0; j < 3; j++)
+        {
+            float w = m[4 * j + 0] * p[0] + m[4 * j + 1] * p[1] + m[4 * j + 2] * p[2] + m[4 * j + 3];
+            bbox[j] = std::min(bbox[j], w);
+            bbox[j + 3] = std::max(bbox[j + 3], w);
+        }
+    }
+}
+
+void emptyBoundingBox(float bbox[6])
+{
+    for(int j = 0; j < 3; j++)
+    {
+        bbox[j] = std::numeric_limits<float>::max();
+        bbox[j + 3] = -std::numeric_limits<float>::max();
+    }
+}
+
+bool boundingBoxesOverlap(const float a[6], const float b[6])
+{
+    for(int j = 0; j < 3; j++)
+        if(a[j] > b[j + 3] || b[j] > a[j + 3])
+            return false;
+    return true;
+}
+
+// world bounding box of the shapes in the tree of an object, in its current
+// pose; returns false if the object has no shapes:
+bool treeBoundingBox(simInt handle, float bbox[6])
+{
+    simInt count = 0;
+    simInt *shapes = simGetObjectsInTree(handle, sim_object_shape_type, 0, &count);
+    emptyBoundingBox(bbox);
+    for(simInt k = 0; k < count; k++)
+    {
+        simFloat local[6], m[12];
+        shapeLocalBox(shapes[k], local);
+        simGetObjectMatrix(shapes[k], -1, &m[0]);
+        growBoundingBox(local, m, bbox);
+    }
+    if(shapes)
+        simReleaseBuffer((simChar *)shapes);
+    return count > 0;
+}
+
+// reads the local bounding boxes of the shapes checked by the collision
+// pairs (exact shapes, proxies and culled map shapes), so that their world
+// boxes cost one API call per check (see shapeWorldBox):
+void cacheShapeBoxes(TaskDef *task)
+{
+    task->shapeBoxes.clear();
+
+    std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+    for(int pass = 0; pass < 2; pass++)
+    {
+        const std::vector<simInt> &handles = pass == 0 ? task->collisionPairCheckHandles : task->collisionPairExactHandles;
+        for(size_t i = 0; i < handles.size(); i++)
+        {
+            simInt shape = handles[i];
+            if(shape < 0 || task->shapeBoxes.count(shape) || simIsHandleValid(shape, sim_appobj_object_type) <= 0 || simGetObjectType(shape) != sim_object_shape_type)
+                continue;
+            std::vector<float> &local = task->shapeBoxes[shape];
+            local.resize(6);
+            shapeLocalBox(shape, &local[0]);
+        }
+    }
+}
+
+// world bounding box of a shape cached by cacheShapeBoxes, in its current
+// pose; returns false if the shape isn't cached (e.g. a collection):
+bool shapeWorldBox(const TaskDef *task, simInt shape, float bbox[6])
+{
+    std::map<simInt, std::vector<float> >::const_iterator it = task->shapeBoxes.find(shape);
+    if(it == task->shapeBoxes.end())
+        return false;
+    simFloat m[12];
+    if(simGetObjectMatrix(shape, -1, &m[0]) == -1)
+        return false;
+    emptyBoundingBox(bbox);
+    growBoundingBox(&it->second[0], m, bbox);
+    return true;
+}
+
+// upper bound on the distance between the origin of an object and any point
+// of the shapes in the tree of another object below it, valid for any
+// configuration of the joints in between (sum of the lengths along the
+// kinematic chain, stretched by the travel of the prismatic joints, and of
+// the origin itself if stretchOrigin is set):
+double treeReach(simInt origin, simInt tree, bool stretchOrigin)
+{
+    double radius = 0.0;
+
+    simInt count = 0;
+    simInt *shapes = simGetObjectsInTree(tree, sim_object_shape_type, 0, &count);
+
+    for(simInt k = 0; k < count; k++)
+    {
+        double chain = 0.0;
+        simInt o = shapes[k];
+        while(o != origin && o != -1)
+        {
+            simInt parent = simGetObjectParent(o);
+
+            simFloat pos[3];
+            simGetObjectPosition(o, parent, &pos[0]);
+            chain += std::sqrt(pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2]);
+
+            // prismatic joints in between can stretch the chain (by their
+            // travel from the current position, which pos may include):
+            if((parent != origin || stretchOrigin) && parent != -1 && simGetObjectType(parent) == sim_object_joint_type && simGetJointType(parent) == sim_joint_prismatic_subtype)
+            {
+                simBool cyclic;
+                simFloat interval[2], position = 0.0f;
+                simGetJointInterval(parent, &cyclic, &interval[0]);
+                simGetJointPosition(parent, &position);
+                chain += std::fabs(position) + std::max(std::fabs(interval[0]), std::fabs(interval[0] + interval[1]));
+            }
+
+            o = parent;
+        }
+
+        static const simInt bboxParams[2][3] = {
+            {sim_objfloatparam_objbbox_min_x, sim_objfloatparam_objbbox_min_y, sim_objfloatparam_objbbox_min_z},
+            {sim_objfloatparam_objbbox_max_x, sim_objfloatparam_objbbox_max_y, sim_objfloatparam_objbbox_max_z}
+        };
+        double extent = 0.0;
+        for(int j = 0; j < 3; j++)
+        {
+            simFloat vmin = 0.0f, vmax = 0.0f;
+            simGetObjectFloatParameter(shapes[k], bboxParams[0][j], &vmin);
+            simGetObjectFloatParameter(shapes[k], bboxParams[1][j], &vmax);
+            double e = std::max(std::fabs(vmin), std::fabs(vmax));
+            extent += e * e;
+        }
+
+        radius = std::max(radius, chain + std::sqrt(extent));
+    }
+
+    if(shapes)
+        simReleaseBuffer((simChar *)shapes);
+
+    return radius;
+}
+
+// sphere containing the shapes in the tree of an object in every state: the
+// outermost joint of the state space moving the object doesn't move itself,
+// so the shapes stay within treeReach of its origin (revolute joints keep
+// distances to their origin, prismatic ones stretch them by their travel).
+// An object not moved by the state gets the sphere around its bounding box.
+// Returns false if the object has no shapes, or is moved by a state space
+// component other than a revolute or prismatic joint (e.g. a pose), for which
+// there is no such bound.
+bool workspaceSphere(const TaskDef *task, simInt handle, double center[3], double &radius)
+{
+    simInt top = -1;
+    for(simInt o = handle; o != -1; o = simGetObjectParent(o))
+    {
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            const StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+            if(stateSpace->objectHandle != o)
+                continue;
+            if(stateSpace->type != sim_ompl_statespacetype_joint_position || simGetObjectType(o) != sim_object_joint_type)
+                return false;
+            int jointType = simGetJointType(o);
+            if(jointType != sim_joint_revolute_subtype && jointType != sim_joint_prismatic_subtype)
+                return false;
+            top = o;
+        }
+    }
+
+    if(top == -1)
+    {
+        float bbox[6];
+        if(!treeBoundingBox(handle, bbox))
+            return false;
+        radius = 0.0;
+        for(int j = 0; j < 3; j++)
+        {
+            center[j] = (bbox[j] + bbox[j + 3]) / 2;
+            radius += (bbox[j + 3] - bbox[j]) * (bbox[j + 3] - bbox[j]) / 4;
+        }
+        radius = std::sqrt(radius);
+        return true;
+    }
+
+    simInt count = 0;
+    simInt *shapes = simGetObjectsInTree(handle, sim_object_shape_type, 0, &count);
+    if(shapes)
+        simReleaseBuffer((simChar *)shapes);
+    if(count == 0)
+        return false;
+    simFloat p[3];
+    simGetObjectPosition(top, -1, &p[0]);
+    for(int j = 0; j < 3; j++)
+        center[j] = p[j];
+    radius = treeReach(top, handle, true);
+    return true;
+}
+
+// bounds the workspace of each object colliding with the current obstacle map
+// (see loadMap) by a sphere (see workspaceSphere) plus a margin, and checks it
+// against a copy of the map holding only the triangles whose bounding box
+// comes within that sphere. The map's vertices are taken in world
+// coordinates, so the map shape must not have been moved. Objects without
+// such a bound, or whose sphere holds no triangle, are checked against the
+// whole map.
+void cullWorkspace(TaskDef *task)
+{
+    removeCulledMapShapes(task);
+    task->collisionPairCheckHandles = task->collisionPairHandles;
+
+    if(task->workspaceCullingSamples <= 0 || mapcache::currentShape == -1 || simIsHandleValid(mapcache::currentShape, sim_appobj_object_type) <= 0)
+        return;
+    std::map<uint64_t, mapcache::Mesh>::const_iterator mesh = mapcache::meshes.find(mapcache::currentHash);
+    if(mesh == mapcache::meshes.end())
+        return;
+
+    // the objects colliding with the map, and their workspace spheres
+    // (center, radius):
+    std::map<simInt, std::vector<float> > workspaces;
+    size_t n = task->collisionPairHandles.size() / 2;
+    for(size_t i = 0; i < n; i++)
+    {
+        for(int j = 0; j < 2; j++)
+        {
+            simInt a = task->collisionPairHandles[2 * i + j], b = task->collisionPairHandles[2 * i + 1 - j];
+            if(b == mapcache::currentShape && a >= 0 && simIsHandleValid(a, sim_appobj_object_type) > 0)
+                workspaces[a] = std::vector<float>();
+        }
+    }
+    if(workspaces.empty())
+        return;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+        for(std::map<simInt, std::vector<float> >::iterator it = workspaces.begin(); it != workspaces.end(); ++it)
+        {
+            double center[3], radius;
+            if(workspaceSphere(task, it->first, center, radius))
+                it->second.assign({(float)center[0], (float)center[1], (float)center[2], (float)(radius + task->workspaceCullingMargin)});
+        }
+    }
+
+    const mapcache::Header *h = mesh->second.header();
+    const float *vertices = mesh->second.vertices();
+    const int32_t *indices = mesh->second.indices();
+    for(std::map<simInt, std::vector<float> >::iterator it = workspaces.begin(); it != workspaces.end(); ++it)
+    {
+        const std::vector<float> &w = it->second;
+        if(w.empty())
+            continue; // no bound, keep checking against the whole map
+
+        // triangles whose bounding box comes within the workspace sphere,
+        // with their vertices renumbered:
+        std::vector<float> culledVertices;
+        std::vector<int32_t> culledIndices, renumbered(h->vertexCount, -1);
+        for(uint32_t t = 0; t + 2 < h->indexCount; t += 3)
+        {
+            double distance2 = 0.0;
+            for(int j = 0; j < 3; j++)
+            {
+                float lo = vertices[3 * indices[t] + j], hi = lo;
+                for(int c = 1; c < 3; c++)
+                {
+                    lo = std::min(lo, vertices[3 * indices[t + c] + j]);
+                    hi = std::max(hi, vertices[3 * indices[t + c] + j]);
+                }
+                double d = std::max(0.0, std::max((double)lo - w[j], (double)w[j] - hi));
+                distance2 += d * d;
+            }
+            if(distance2 > (double)w[3] * w[3]) continue;
+            for(int c = 0; c < 3; c++)
+            {
+                int32_t &v = renumbered[indices[t + c]];
+                if(v == -1)
+                {
+                    v = culledVertices.size() / 3;
+                    culledVertices.insert(culledVertices.end(), &vertices[3 * indices[t + c]], &vertices[3 * indices[t + c]] + 3);
+                }
+                culledIndices.push_back(v);
+            }
+        }
+
+        // with nothing in the sphere, the pairs are still checked against the
+        // whole map (a mesh shape can't be empty)
+        simInt culled = -1;
+        if(!culledIndices.empty() && culledIndices.size() < h->indexCount)
+        {
+            culled = simCreateMeshShape(0, 0.5f, culledVertices.data(), culledVertices.size(), culledIndices.data(), culledIndices.size(), nullptr);
+            if(culled != -1)
+            {
+                simSetObjectSpecialProperty(culled, sim_objectspecialproperty_collidable | sim_objectspecialproperty_measurable);
+                simSetObjectInt32Parameter(culled, sim_objintparam_visibility_layer, 0);
+                task->culledMapShapes.push_back(culled);
+                for(size_t i = 0; i < n; i++)
+                {
+                    for(int j = 0; j < 2; j++)
+                    {
+                        if(task->collisionPairHandles[2 * i + j] == it->first && task->collisionPairHandles[2 * i + 1 - j] == mapcache::currentShape)
+                            task->collisionPairCheckHandles[2 * i + 1 - j] = culled;
+                    }
+                }
+            }
+        }
+
+        if(task->verboseLevel >= 1)
+        {
+            std::stringstream s;
+            s << "OMPL: object " << it->first << " can reach " << culledIndices.size() / 3 << " of " << h->indexCount / 3 << " map triangles.";
+            simAddStatusbarMessage(s.str().c_str());
+        }
+    }
+
+    resetCollisionPairOrder(task);
+}
+
+// splits the triangles of a mesh into (at most) the given number of clusters
+// of neighbouring triangles, by repeatedly halving the largest cluster at the
+// median of its triangle centroids along its longest axis:
+std::vector<std::vector<size_t> > clusterTriangles(const simFloat *vertices, const simInt *indices, size_t triangleCount, int clusterCount)
+{
+    // triangle centroids:
+    std::vector<float> centroids(3 * triangleCount);
+    for(size_t t = 0; t < triangleCount; t++)
+        for(int j = 0; j < 3; j++)
+            centroids[3 * t + j] = (vertices[3 * indices[3 * t + 0] + j] + vertices[3 * indices[3 * t + 1] + j] + vertices[3 * indices[3 * t + 2] + j]) / 3;
+
+    std::vector<std::vector<size_t> > clusters(1);
+    for(size_t t = 0; t < triangleCount; t++)
+        clusters[0].push_back(t);
+    while((int)clusters.size() < clusterCount)
+    {
+        size_t largest = 0;
+        for(size_t c = 1; c < clusters.size(); c++)
+            if(clusters[c].size() > clusters[largest].size())
+                largest = c;
+        std::vector<size_t> &cluster = clusters[largest];
+        if(cluster.size() < 2) break;
+
+        float lo[3], hi[3];
+        for(int j = 0; j < 3; j++)
+        {
+            lo[j] = std::numeric_limits<float>::max();
+            hi[j] = -std::numeric_limits<float>::max();
+        }
+        for(size_t k = 0; k < cluster.size(); k++)
+            for(int j = 0; j < 3; j++)
+            {
+                lo[j] = std::min(lo[j], centroids[3 * cluster[k] + j]);
+                hi[j] = std::max(hi[j], centroids[3 * cluster[k] + j]);
+            }
+        int axis = 0;
+        for(int j = 1; j < 3; j++)
+            if(hi[j] - lo[j] > hi[axis] - lo[axis])
+                axis = j;
+
+        std::vector<size_t>::iterator middle = cluster.begin() + cluster.size() / 2;
+        std::nth_element(cluster.begin(), middle, cluster.end(), [&](size_t a, size_t b) { return centroids[3 * a + axis] < centroids[3 * b + axis]; });
+        std::vector<size_t> upper(middle, cluster.end());
+        cluster.erase(middle, cluster.end());
+        clusters.push_back(upper);
+    }
+    return clusters;
+}
+
+// approximates a mesh by the union of the given number of convex hulls, each
+// inflated by (at least) the margin, grouped into one hidden collidable shape.
+// The triangles are split into that many clusters (see clusterTriangles) and
+// each cluster is replaced by its convex hull, so the union of the hulls
+// contains the whole mesh. Collision checks only intersect surfaces, though:
+// they report collisions the mesh doesn't have, but miss obstacles lying
+// entirely inside a hull, even when those cross the mesh itself.
+// Vertices are transformed by m into world coordinates. Returns -1 on failure.
+simInt createConvexHulls(const simFloat *vertices, const simInt *indices, size_t triangleCount, int hullCount, double margin, const simFloat *m)
+{
+    std::vector<std::vector<size_t> > clusters = clusterTriangles(vertices, indices, triangleCount, hullCount);
+
+    std::vector<simInt> hulls;
+    for(size_t c = 0; c < clusters.size(); c++)
+    {
+        std::vector<simFloat> points;
+        for(size_t k = 0; k < clusters[c].size(); k++)
+            for(int v = 0; v < 3; v++)
+                points.insert(points.end(), &vertices[3 * indices[3 * clusters[c][k] + v]], &vertices[3 * indices[3 * clusters[c][k] + v]] + 3);
+
+        simFloat *hullVertices = nullptr;
+        simInt *hullIndices = nullptr, hullVerticesSize = 0, hullIndicesSize = 0;
+        if(simGetQHull(points.data(), points.size(), &hullVertices, &hullVerticesSize, &hullIndices, &hullIndicesSize, 0, nullptr) == -1)
+        {
+            // degenerate (e.g. flat) cluster: keep its triangles as they are
+            std::vector<simFloat> world(points.size());
+            std::vector<simInt> clusterIndices(points.size() / 3);
+            for(size_t v = 0; v < clusterIndices.size(); v++)
+            {
+                clusterIndices[v] = v;
+                for(int j = 0; j < 3; j++)
+                    world[3 * v + j] = m[4 * j + 0] * points[3 * v + 0] + m[4 * j + 1] * points[3 * v + 1] + m[4 * j + 2] * points[3 * v + 2] + m[4 * j + 3];
+            }
+            simInt mesh = simCreateMeshShape(0, 0.5f, world.data(), world.size(), clusterIndices.data(), clusterIndices.size(), nullptr);
+            if(mesh != -1)
+                hulls.push_back(mesh);
+            continue;
+        }
+
+        // inflate: scaling about an inner point by s moves each face out by
+        // (s - 1) times its distance to that point, so scale until the
+        // closest face has moved by the margin:
+        double center[3] = {0, 0, 0};
+        for(simInt v = 0; v < hullVerticesSize / 3; v++)
+            for(int j = 0; j < 3; j++)
+                center[j] += hullVertices[3 * v + j] / (hullVerticesSize / 3);
+        double minDistance = std::numeric_limits<double>::infinity();
+        for(simInt f = 0; f < hullIndicesSize / 3; f++)
+        {
+            const simFloat *a = &hullVertices[3 * hullIndices[3 * f + 0]], *b = &hullVertices[3 * hullIndices[3 * f + 1]], *d = &hullVertices[3 * hullIndices[3 * f + 2]];
+            double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]}, w[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+            double n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+            double norm = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if(norm > 0)
+                minDistance = std::min(minDistance, std::fabs(n[0] * (a[0] - center[0]) + n[1] * (a[1] - center[1]) + n[2] * (a[2] - center[2])) / norm);
+        }
+        double scale = minDistance > 1e-9 && minDistance < std::numeric_limits<double>::infinity() ? 1.0 + margin / minDistance : 1.0;
+
+        // to world coordinates, as expected by simCreateMeshShape:
+        std::vector<simFloat> world(hullVerticesSize);
+        for(simInt v = 0; v < hullVerticesSize / 3; v++)
+        {
+            double q[3];
+            for(int j = 0; j < 3; j++)
+                q[j] = center[j] + scale * (hullVertices[3 * v + j] - center[j]);
+            for(int j = 0; j < 3; j++)
+                world[3 * v + j] = m[4 * j + 0] * q[0] + m[4 * j + 1] * q[1] + m[4 * j + 2] * q[2] + m[4 * j + 3];
+        }
+        simInt hull = simCreateMeshShape(0, 0.5f, world.data(), world.size(), hullIndices, hullIndicesSize, nullptr);
+        if(hull != -1)
+            hulls.push_back(hull);
+        simReleaseBuffer((simChar *)hullVertices);
+        simReleaseBuffer((simChar *)hullIndices);
+    }
+
+    if(hulls.size() < clusters.size())
+    {
+        // a missing cluster would leave part of the mesh uncovered
+        for(size_t h = 0; h < hulls.size(); h++)
+            simRemoveObject(hulls[h]);
+        return -1;
+    }
+
+    simInt group = hulls.size() == 1 ? hulls[0] : simGroupShapes(hulls.data(), hulls.size());
+    if(group == -1)
+        return -1;
+    simSetObjectSpecialProperty(group, sim_objectspecialproperty_collidable | sim_objectspecialproperty_measurable);
+    simSetObjectInt32Parameter(group, sim_objintparam_visibility_layer, 0);
+    return group;
+}
+
+// convex proxy of a shape (see createConvexHulls), attached to it; returns -1
+// if the shape's mesh can't be read:
+simInt buildCollisionProxy(simInt shape, int hullCount, double margin)
+{
+    simFloat *vertices = nullptr, *normals = nullptr;
+    simInt *indices = nullptr, verticesSize = 0, indicesSize = 0;
+    if(simGetShapeMesh(shape, &vertices, &verticesSize, &indices, &indicesSize, &normals) == -1)
+        return -1;
+
+    // the mesh is in the shape's frame:
+    simFloat m[12];
+    simGetObjectMatrix(shape, -1, &m[0]);
+    simInt proxy = createConvexHulls(vertices, indices, indicesSize / 3, hullCount, margin, m);
+
+    simReleaseBuffer((simChar *)vertices);
+    simReleaseBuffer((simChar *)indices);
+    simReleaseBuffer((simChar *)normals);
+
+    if(proxy != -1)
+        simSetObjectParent(proxy, shape, true);
+    return proxy;
+}
+
+// replaces the robot shapes (shapes moved by the state) of the collision
+// pairs by their convex proxies, building those not yet cached. With the
+// exact fallback, a proxy pair counts as free only when the proxies' bounding
+// boxes are disjoint, and is checked with the exact meshes otherwise:
+void useCollisionProxies(TaskDef *task)
+{
+    task->collisionPairExactHandles = task->collisionPairCheckHandles;
+
+    std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+    // proxies built with other settings won't be used again:
+    for(std::map<std::pair<simInt, std::pair<int, double> >, simInt>::iterator it = task->collisionProxies.begin(); it != task->collisionProxies.end();)
+    {
+        if(it->first.second == std::make_pair(task->collisionProxyHullCount, task->collisionProxyMargin))
+        {
+            ++it;
+            continue;
+        }
+        if(simIsHandleValid(it->second, sim_appobj_object_type) > 0)
+            simRemoveObject(it->second);
+        task->collisionProxies.erase(it++);
+    }
+    if(task->collisionProxyHullCount <= 0)
+        return;
+
+    int built = 0, used = 0;
+    for(size_t i = 0; i < task->collisionPairHandles.size(); i++)
+    {
+        simInt shape = task->collisionPairHandles[i];
+        if(shape < 0 || simIsHandleValid(shape, sim_appobj_object_type) <= 0 || simGetObjectType(shape) != sim_object_shape_type || !isMovedByState(task, shape))
+            continue;
+
+        std::pair<simInt, std::pair<int, double> > key(shape, std::make_pair(task->collisionProxyHullCount, task->collisionProxyMargin));
+        std::map<std::pair<simInt, std::pair<int, double> >, simInt>::iterator it = task->collisionProxies.find(key);
+        if(it == task->collisionProxies.end() || simIsHandleValid(it->second, sim_appobj_object_type) <= 0)
+        {
+            simInt proxy = buildCollisionProxy(shape, task->collisionProxyHullCount, task->collisionProxyMargin);
+            if(proxy == -1)
+                continue; // keep checking the exact mesh
+            it = task->collisionProxies.insert(std::make_pair(key, proxy)).first;
+            it->second = proxy;
+            built++;
+        }
+        task->collisionPairCheckHandles[i] = it->second;
+        used++;
+    }
+
+    if(task->verboseLevel >= 1)
+    {
+        std::stringstream s;
+        s << "OMPL: " << used << " collision pair entries use convex proxies (" << built << " built).";
+        simAddStatusbarMessage(s.str().c_str());
+    }
+}
+
+// number of boxes of the coarsest level of detail of a map; each finer level
+// has eight times more:
+const int mapLevelBoxCount = 8;
+
+// makes sure the current map has at least the given number of levels of
+// detail, built with the given margin. Level l covers the map by the bounding
+// boxes of mapLevelBoxCount * 8^l clusters of its triangles (see
+// clusterTriangles), each inflated by the margin. The map's vertices are
+// taken in world coordinates, so the map shape must not have been moved. The
+// levels are kept until another map is loaded.
+void buildMapLevels(int count, double margin)
+{
+    if(mapcache::currentLevelsMargin != margin)
+        mapcache::currentLevels.clear();
+    std::map<uint64_t, mapcache::Mesh>::const_iterator mesh = mapcache::meshes.find(mapcache::currentHash);
+    if(mesh == mapcache::meshes.end())
+        return;
+    const mapcache::Header *h = mesh->second.header();
+    const float *vertices = mesh->second.vertices();
+    const int32_t *indices = mesh->second.indices();
+
+    for(int l = mapcache::currentLevels.size(); l < count; l++)
+    {
+        int boxCount = mapLevelBoxCount << (3 * l);
+        if((size_t)boxCount >= h->indexCount / 3)
+            break; // not coarser than the map itself
+        std::vector<std::vector<size_t> > clusters = clusterTriangles(vertices, indices, h->indexCount / 3, boxCount);
+        std::vector<float> level(6 * clusters.size());
+        for(size_t c = 0; c < clusters.size(); c++)
+        {
+            float *box = &level[6 * c];
+            for(int j = 0; j < 3; j++)
+            {
+                box[j] = std::numeric_limits<float>::max();
+                box[j + 3] = -std::numeric_limits<float>::max();
+            }
+            for(size_t k = 0; k < clusters[c].size(); k++)
+                for(int v = 0; v < 3; v++)
+                    for(int j = 0; j < 3; j++)
+                    {
+                        float x = vertices[3 * indices[3 * clusters[c][k] + v] + j];
+                        box[j] = std::min(box[j], x);
+                        box[j + 3] = std::max(box[j + 3], x);
+                    }
+            for(int j = 0; j < 3; j++)
+            {
+                box[j] -= margin;
+                box[j + 3] += margin;
+            }
+        }
+        mapcache::currentLevels.push_back(level);
+    }
+    mapcache::currentLevelsMargin = margin;
+}
+
+// makes the pairs of a robot shape with the current map check its coarse
+// levels of detail first. The boxes of a level contain the whole map, so the
+// pair is free when the bounding box of the shape (cached by cacheShapeBoxes)
+// overlaps none of them. Pairs with collections, or with objects that aren't
+// shapes, are always checked against the map itself:
+void useMapLevelsOfDetail(TaskDef *task)
+{
+    size_t n = task->collisionPairHandles.size() / 2;
+    task->collisionPairLevelShapes.assign(n, -1);
+    task->collisionPairLevelsMap = mapcache::currentHash;
+    if(task->mapLevelsOfDetail <= 0 || mapcache::currentShape == -1 || simIsHandleValid(mapcache::currentShape, sim_appobj_object_type) <= 0)
+        return;
+
+    std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+    buildMapLevels(task->mapLevelsOfDetail, task->mapLevelsOfDetailMargin);
+    size_t count = std::min((size_t)task->mapLevelsOfDetail, mapcache::currentLevels.size());
+    if(count == 0)
+        return;
+    for(size_t i = 0; i < n; i++)
+    {
+        for(int j = 0; j < 2; j++)
+        {
+            simInt shape = task->collisionPairHandles[2 * i + j];
+            if(task->collisionPairHandles[2 * i + 1 - j] != mapcache::currentShape || shape < 0 || simIsHandleValid(shape, sim_appobj_object_type) <= 0 || simGetObjectType(shape) != sim_object_shape_type)
+                continue;
+            task->collisionPairLevelShapes[i] = shape;
+        }
+    }
+
+    if(task->verboseLevel >= 1)
+    {
+        std::stringstream s;
+        s << "OMPL: checking " << count << " levels of detail of the map first.";
+        simAddStatusbarMessage(s.str().c_str());
+    }
+}
+
+// kinematic model of the chain of objects going from the scene root to a tip
+// object, extracted from the scene when the task is set up. Joints that are
+// part of the task's state space are variable, everything else is rigid, so
+// the pose of the tip can be computed for a state without writing it to the
+// scene. Transforms are 3x4 matrices, with the layout of simGetObjectMatrix.
+class KinematicChain
+{
+public:
+    KinematicChain(TaskDef *task, simInt tipHandle, simInt refHandle)
+        : valid(false)
+    {
+        build(task, tipHandle, refHandle);
+
+        // make sure the model agrees with the scene:
+        if(valid)
+        {
+            ob::ScopedState<ob::CompoundStateSpace> s(task->stateSpacePtr);
+            task->stateSpacePtr->as<StateSpace>()->readState(s);
+            double m[12];
+            tipPose(s.get(), m);
+            simFloat actual[12];
+            simGetObjectMatrix(tipHandle, refHandle, &actual[0]);
+            for(int i = 0; i < 12; i++)
+            {
+                if(std::fabs(m[i] - actual[i]) > 1e-4)
+                    valid = false;
+            }
+        }
+    }
+
+    // false if the pose of the tip can't be computed from the state alone
+    // (e.g. if it is moved by a state space component other than a joint):
+    bool isValid() const
+    {
+        return valid;
+    }
+
+    // computes the pose of the tip, relative to the reference frame:
+    void tipPose(const ob::State *state, double *m) const
+    {
+        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+
+        double t[12], j[12];
+        identity(m);
+        for(size_t i = 0; i < segments.size(); i++)
+        {
+            const Segment &seg = segments[i];
+            multiply(m, seg.fixed, t);
+            jointTransform(seg.prismatic, s->as<ob::RealVectorStateSpace::StateType>(seg.component)->values[0], j);
+            multiply(t, j, m);
+        }
+        multiply(m, tail, t);
+        std::copy(t, t + 12, m);
+    }
+
+    // indices (in the compound state) of the joints that move the tip:
+    std::vector<int> jointComponents() const
+    {
+        std::vector<int> components;
+        for(size_t i = 0; i < segments.size(); i++)
+            components.push_back(segments[i].component);
+        return components;
+    }
+
+    // angle of the rotation between the orientations of two transforms
+    // (same as the angle returned by simGetRotationAxis):
+    static double rotationAngle(const double *a, const double *b)
+    {
+        double trace = 0.0;
+        for(int r = 0; r < 3; r++)
+            for(int c = 0; c < 3; c++)
+                trace += a[4 * r + c] * b[4 * r + c];
+        return std::acos(std::max(-1.0, std::min(1.0, (trace - 1.0) / 2.0)));
+    }
+
+protected:
+    void build(TaskDef *task, simInt tipHandle, simInt refHandle)
+    {
+        // the reference frame must not move with the state:
+        if(refHandle != -1 && isMovedByState(task, refHandle))
+            return;
+
+        // objects from the root to the tip:
+        std::vector<simInt> chain;
+        for(simInt o = tipHandle; o != -1; o = simGetObjectParent(o))
+            chain.push_back(o);
+        std::reverse(chain.begin(), chain.end());
+
+        double fixed[12], frame[12], world[12], local[12], m[12], t[12];
+
+        // everything is expressed relative to the reference frame:
+        if(refHandle == -1)
+        {
+            identity(fixed);
+        }
+        else
+        {
+            getObjectMatrix(refHandle, m);
+            invert(m, fixed);
+        }
+
+        // frame seen by the children of the previous object:
+        identity(frame);
+
+        for(size_t k = 0; k < chain.size(); k++)
+        {
+            simInt o = chain[k];
+
+            getObjectMatrix(o, world);
+            invert(frame, m);
+            multiply(m, world, local);
+            multiply(fixed, local, t);
+            std::copy(t, t + 12, fixed);
+
+            bool isJoint = simGetObjectType(o) == sim_object_joint_type;
+            if(isJoint)
+            {
+                getJointMatrix(o, m);
+                multiply(world, m, frame);
+            }
+            else
+            {
+                std::copy(world, world + 12, frame);
+            }
+
+            int component = -1;
+            for(size_t i = 0; i < task->stateSpaces.size(); i++)
+            {
+                if(statespaces[task->stateSpaces[i]]->objectHandle == o)
+                {
+                    if(statespaces[task->stateSpaces[i]]->type != sim_ompl_statespacetype_joint_position)
+                        return;
+                    component = i;
+                }
+            }
+
+            if(component >= 0)
+            {
+                int jointType = simGetJointType(o);
+                if(jointType != sim_joint_revolute_subtype && jointType != sim_joint_prismatic_subtype)
+                    return;
+
+                Segment seg;
+                std::copy(fixed, fixed + 12, seg.fixed);
+                seg.component = component;
+                seg.prismatic = jointType == sim_joint_prismatic_subtype;
+                segments.push_back(seg);
+                identity(fixed);
+            }
+            else if(isJoint)
+            {
+                // not part of the state space: rigid at its current position
+                getJointMatrix(o, m);
+                multiply(fixed, m, t);
+                std::copy(t, t + 12, fixed);
+            }
+        }
+
+        std::copy(fixed, fixed + 12, tail);
+        valid = true;
+    }
+
+    static void getObjectMatrix(simInt handle, double *m)
+    {
+        simFloat f[12];
+        simGetObjectMatrix(handle, -1, &f[0]);
+        std::copy(f, f + 12, m);
+    }
+
+    static void getJointMatrix(simInt handle, double *m)
+    {
+        simFloat f[12];
+        simGetJointMatrix(handle, &f[0]);
+        std::copy(f, f + 12, m);
+    }
+
+    static void identity(double *m)
+    {
+        for(int i = 0; i < 12; i++)
+            m[i] = (i % 5 == 0) ? 1.0 : 0.0;
+    }
+
+    // r = a * b
+    static void multiply(const double *a, const double *b, double *r)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 4; j++)
+            {
+                r[4 * i + j] = a[4 * i + 0] * b[j] + a[4 * i + 1] * b[4 + j] + a[4 * i + 2] * b[8 + j];
+                if(j == 3)
+                    r[4 * i + j] += a[4 * i + 3];
+            }
+        }
+    }
+
+    // r = a^-1 (a must be a rigid transform)
+    static void invert(const double *a, double *r)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 3; j++)
+                r[4 * i + j] = a[4 * j + i];
+            r[4 * i + 3] = -(a[i] * a[3] + a[4 + i] * a[7] + a[8 + i] * a[11]);
+        }
+    }
+
+    // intrinsic transform of a joint: rotation or translation along its z axis
+    static void jointTransform(bool prismatic, double q, double *m)
+    {
+        identity(m);
+        if(prismatic)
+        {
+            m[11] = q;
+        }
+        else
+        {
+            m[0] = std::cos(q); m[1] = -std::sin(q);
+            m[4] = std::sin(q); m[5] = std::cos(q);
+        }
+    }
+
+    struct Segment
+    {
+        // rigid transform from the previous joint to this joint:
+        double fixed[12];
+        // index of the joint in the compound state:
+        int component;
+        bool prismatic;
+    };
+
+    std::vector<Segment> segments;
+    // rigid transform from the last joint to the tip:
+    double tail[12];
+    bool valid;
+};
+
+// converts a state to the array passed to Lua callbacks; reals is a scratch
+// buffer owned by the caller, so that repeated calls don't allocate:
+void stateToFloats(const ob::StateSpacePtr &space, const ob::State *state, std::vector<double> &reals, std::vector<float> &floats)
+{
+    space->copyToReals(reals, state);
+    floats.resize(reals.size());
+    for(size_t i = 0; i < reals.size(); i++)
+        floats[i] = (float)reals[i];
+}
+
+class ProjectionEvaluator : public ob::ProjectionEvaluator
+{
+public:
+    ProjectionEvaluator(const ob::StateSpacePtr& space, TaskDef *task)
+        : ob::ProjectionEvaluator(space), statespace(space)
+    {
+        this->task = task;
+
+        dim = 0;
+
+        switch(task->projectionEvaluation.type)
+        {
+        case TaskDef::ProjectionEvaluation::DEFAULT:
+            switch(task->goal.type)
+            {
+            case TaskDef::Goal::STATE:
+            case TaskDef::Goal::CLLBACK:
+            case TaskDef::Goal::NATIVE:
+                dim = defaultProjectionSize();
+                break;
+            case TaskDef::Goal::DUMMY_PAIR:
+                dim = dummyPairProjectionSize();
+                break;
+            default:
+                // this will never happen
+                dim = 0;
+                break;
+            }
+            break;
+        case TaskDef::ProjectionEvaluation::CLLBACK:
+            dim = luaProjectCallbackSize();
+            break;
+        default:
+            // this will never happen
+            dim = 0;
+            break;
+        }
+    }
+
+    virtual unsigned int getDimension(void) const
+    {
+        return dim;
+    }
+
+    virtual void defaultCellSizes(void)
+    {
+        cellSizes_.resize(dim);
+
+        if(!task->projectionEvaluation.cellSizes.empty())
+        {
+            for(int i = 0; i < dim; i++)
+                cellSizes_[i] = task->projectionEvaluation.cellSizes[i];
+            return;
+        }
+
+        // sample the space to find the extent of the projection, and split
+        // it in the requested number of cells:
+        estimateBounds();
+        std::vector<double> extent = bounds_.getDifference();
+        for(int i = 0; i < dim; i++)
+        {
+            if(extent[i] > std::numeric_limits<double>::epsilon())
+                cellSizes_[i] = extent[i] / task->projectionEvaluation.cellsPerDimension;
+            else
+                cellSizes_[i] = 1.0; // projection is constant along this axis
+        }
+    }
+
+    virtual void project(const ob::State *state, ob::EuclideanProjection& projection) const
+    {
+        for(int i = 0; i < dim; i++)
+            projection(i) = 0.0;
+
+        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+
+        switch(task->projectionEvaluation.type)
+        {
+        case TaskDef::ProjectionEvaluation::DEFAULT:
+            switch(task->goal.type)
+            {
+            case TaskDef::Goal::STATE:
+            case TaskDef::Goal::CLLBACK:
+            case TaskDef::Goal::NATIVE:
+                defaultProjection(state, projection);
+                break;
+            case TaskDef::Goal::DUMMY_PAIR:
+                dummyPairProjection(state, projection);
+                break;
+            }
+            break;
+        case TaskDef::ProjectionEvaluation::CLLBACK:
+            luaProjectCallback(state, projection);
+            break;
+        }
+    }
+
+protected:
+    virtual int defaultProjectionSize() const
+    {
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+
+            if(!stateSpace->defaultProjection) continue;
+
+            switch(stateSpace->type)
+            {
+            case sim_ompl_statespacetype_pose2d:
+            case sim_ompl_statespacetype_position2d:
+                return 2;
+            case sim_ompl_statespacetype_pose3d:
+            case sim_ompl_statespacetype_position3d:
+                return 3;
+            case sim_ompl_statespacetype_joint_position:
+                return 1;
+            case sim_ompl_statespacetype_dubins:
+                return 2;
+            }
+        }
+
+        return 0;
+    }
+
+    virtual void defaultProjection(const ob::State *state, ob::EuclideanProjection& projection) const
+    {
+        const ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+
+            if(!stateSpace->defaultProjection) continue;
+
+            switch(stateSpace->type)
+            {
+            case sim_ompl_statespacetype_pose2d:
+                projection(0) = s->as<ob::SE2StateSpace::StateType>(i)->getX();
+                projection(1) = s->as<ob::SE2StateSpace::StateType>(i)->getY();
+                break;
+            case sim_ompl_statespacetype_pose3d:
+                projection(0) = s->as<ob::SE3StateSpace::StateType>(i)->getX();
+                projection(1) = s->as<ob::SE3StateSpace::StateType>(i)->getY();
+                projection(2) = s->as<ob::SE3StateSpace::StateType>(i)->getZ();
+                break;
+            case sim_ompl_statespacetype_position2d:
+                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
+                projection(1) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[1];
+                break;
+            case sim_ompl_statespacetype_position3d:
+                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
+                projection(1) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[1];
+                projection(2) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[2];
+                break;
+            case sim_ompl_statespacetype_joint_position:
+                projection(0) = s->as<ob::RealVectorStateSpace::StateType>(i)->values[0];
+                break;
+            case sim_ompl_statespacetype_dubins:
+                projection(0) = s->as<ob::SE2StateSpace::StateType>(i)->getX();
+                projection(1) = s->as<ob::SE2StateSpace::StateType>(i)->getY();
+                break;
+            }
+
+            break;
+        }
+    }
+
+    virtual int dummyPairProjectionSize() const
+    {
+        /*
+        return 3;
+        */
+        int s = 0;
+        for(int i = 0; i < 3; i++)
+        {
+            if(task->goal.metric[i] != 0.0)
+                s++;
+        }
+        if(s == 0)
+            s = 1; // if X/Y/Z are ignored
+        return s;
+    }
+
+    virtual void dummyPairProjection(const ob::State *state, ob::EuclideanProjection& projection) const
+    {
+        double pos[3];
+        if(task->robotDummyChain && task->robotDummyChain->isValid())
+        {
+            double m[12];
+            task->robotDummyChain->tipPose(state, m);
+            pos[0] = m[3];
+            pos[1] = m[7];
+            pos[2] = m[11];
+        }
+        else
+        {
+            // apply the state to the robot, read the tip dummy's position, then restore:
+            std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+            ob::ScopedState<ob::CompoundStateSpace> s(statespace);
+            s = state;
+            ob::ScopedState<ob::CompoundStateSpace> s_old(statespace);
+            statespace->as<StateSpace>()->readState(s_old);
+            statespace->as<StateSpace>()->writeState(s);
+            simFloat p[3];
+            simGetObjectPosition(task->goal.dummyPair.robotDummy, task->goal.refDummy, &p[0]);
+            statespace->as<StateSpace>()->writeState(s_old);
+            pos[0] = p[0];
+            pos[1] = p[1];
+            pos[2] = p[2];
+        }
+
+        // do projection, only for axis that should not be ignored:
+        int ind = 0;
+        for(int i = 0; i < 3; i++)
+        {
+            if(task->goal.metric[i] != 0.0)
+                projection(ind++) = pos[i];
+        }
+        if(ind == 0)
+            projection(0) = 0.0; // if X/Y/Z are ignored
+    }
+
+    virtual int luaProjectCallbackSize() const
+    {
+        return task->projectionEvaluation.dim;
+    }
+
+    virtual void luaProjectCallback(const ob::State *state, ob::EuclideanProjection& projection) const
+    {
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+        trace::Scope scope("projectionEvaluationCallback");
+
+        stateToFloats(statespace, state, stateVec, in_args.state);
+
+        projectionEvaluationCallback_out out_args;
+
+        if(projectionEvaluationCallback(task->projectionEvaluation.callback.scriptId, task->projectionEvaluation.callback.function.c_str(), &in_args, &out_args))
+        {
+            for(size_t i = 0; i < out_args.projection.size() && i < dim; i++)
+                projection(i) = out_args.projection[i];
+        }
+        else
+        {
+            throw ompl::Exception("Projection evaluation callback " + task->projectionEvaluation.callback.function + " returned an error");
+        }
+    }
+
+    TaskDef *task;
+    const ob::StateSpacePtr& statespace;
+    int dim;
+    // buffers reused across callback calls:
+    mutable std::vector<double> stateVec;
+    mutable projectionEvaluationCallback_in in_args;
+};
+
+// the last sample drawn on this thread from a BatchValidatingStateSampler,
+// with its validity, so that checking it right after is free:
+struct PrevalidatedSample
+{
+    const ob::StateSpace *space;
+    std::vector<double> values;
+    bool valid;
+};
+
+thread_local PrevalidatedSample prevalidatedSample = {nullptr, std::vector<double>(), false};
+
+// where the validity checks done on this thread are counted instead of the
+// task's validityCheckCount (set on the threads of a ValidSamplePool):
+thread_local std::atomic<unsigned long> *validityCheckCounter = nullptr;
+
+class StateValidityChecker : public ob::StateValidityChecker
+{
+public:
+    StateValidityChecker(const ob::SpaceInformationPtr &si, TaskDef *task)
+        : ob::StateValidityChecker(si), statespace(si->getStateSpace()), task(task)
+    {
+    }
+
+    virtual ~StateValidityChecker()
+    {
+    }
+
+    virtual bool isValid(const ob::State *state) const
+    {
+        if(prevalidatedSample.space == statespace.get())
+        {
+            prevalidatedSample.space = nullptr;
+            static thread_local std::vector<double> values;
+            statespace->copyToReals(values, state);
+            if(values == prevalidatedSample.values)
+                return prevalidatedSample.valid;
+        }
+
+        countValidityChecks(1);
+
+        switch(task->stateValidation.type)
+        {
+        case TaskDef::StateValidation::DEFAULT:
+            return checkDefault(state);
+        case TaskDef::StateValidation::CLLBACK:
+            return checkCallback(state);
+        case TaskDef::StateValidation::BATCH_CLLBACK:
+        {
+            static thread_local std::vector<bool> batchValid;
+            return checkBatchCallback(&state, 1, batchValid) && batchValid[0];
+        }
+        case TaskDef::StateValidation::NATIVE:
+            return checkNative(state);
+        }
+        return false;
+    }
+
+    // checks a block of states at once; with a batched callback this costs a
+    // single call into Lua:
+    void isValid(const ob::State *const *states, size_t count, std::vector<bool> &valid) const
+    {
+        if(task->stateValidation.type == TaskDef::StateValidation::BATCH_CLLBACK)
+        {
+            countValidityChecks(count);
+            checkBatchCallback(states, count, valid);
+        }
+        else
+        {
+            valid.resize(count);
+            for(size_t i = 0; i < count; i++)
+                valid[i] = isValid(states[i]);
+        }
+    }
+
+    // same as isValid(state), but also reports the minimum distance between
+    // the collision pairs (0 if the state is invalid or if not available):
+    virtual bool isValid(const ob::State *state, double &dist) const
+    {
+        switch(task->stateValidation.type)
+        {
+        case TaskDef::StateValidation::DEFAULT:
+            countValidityChecks(1);
+            return checkDefault(state, dist);
+        case TaskDef::StateValidation::CLLBACK:
+        case TaskDef::StateValidation::BATCH_CLLBACK:
+        case TaskDef::StateValidation::NATIVE:
+            dist = 0.0;
+            return isValid(state);
+        }
+        dist = 0.0;
+        return false;
+    }
+
+    virtual double clearance(const ob::State *state) const
+    {
+        double dist = 0.0;
+        isValid(state, dist);
+        return dist;
+    }
+
+protected:
+    virtual bool checkDefault(const ob::State *state) const
+    {
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+        //ob::CompoundStateSpace *ss = statespace->as<ob::CompoundStateSpace>();
+        ob::ScopedState<ob::CompoundStateSpace> s(statespace);
+        s = state;
+
+        // save old state:
+        ob::ScopedState<ob::CompoundStateSpace> s_old(statespace);
+        statespace->as<StateSpace>()->readState(s_old);
+
+        // write query state:
+        statespace->as<StateSpace>()->writeState(s);
+
+        // check collisions:
+        bool inCollision = false;
+        {
+            trace::Scope scope("simCheckCollision");
+            for(size_t k = 0; k < task->collisionPairOrder.size(); k++)
+            {
+                size_t i = task->collisionPairOrder[k];
+                if(task->collisionPairCheckHandles[2 * i + 0] >= 0 && !isFreeAtCoarseLevel(i))
+                {
+                    int r = 0;
+                    if(!isProxyPair(i))
+                        r = simCheckCollision(task->collisionPairCheckHandles[2 * i + 0], task->collisionPairCheckHandles[2 * i + 1]);
+                    else if(!areProxiesApart(i))
+                        r = simCheckCollision(task->collisionPairExactHandles[2 * i + 0], task->collisionPairExactHandles[2 * i + 1]);
+                    collision_count++;
+                    task->collisionCheckCount++;
+                    if(r > 0)
+                    {
+                        inCollision = true;
+                        recordCollisionPairHit(k);
+                        break;
+                    }
+                }
+                if(inCollision) break;
+            }
+        }
+
+        // restore original state:
+        statespace->as<StateSpace>()->writeState(s_old);
+
+        return !inCollision;
+    }
+
+    virtual bool checkDefault(const ob::State *state, double &dist) const
+    {
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+        ob::ScopedState<ob::CompoundStateSpace> s(statespace);
+        s = state;
+
+        // save old state:
+        ob::ScopedState<ob::CompoundStateSpace> s_old(statespace);
+        statespace->as<StateSpace>()->readState(s_old);
+
+        // write query state:
+        statespace->as<StateSpace>()->writeState(s);
+
+        // measure distances (a distance of zero means contact). A pair whose
+        // distance can't be measured (an error, or an entity that isn't
+        // measurable) is checked for collision instead, and leaves the
+        // clearance unknown, reported as zero:
+        dist = std::numeric_limits<double>::infinity();
+        bool unknown = false;
+        {
+            trace::Scope scope("simCheckDistance");
+            for(size_t k = 0; k < task->collisionPairOrder.size(); k++)
+            {
+                size_t i = task->collisionPairOrder[k];
+                if(task->collisionPairCheckHandles[2 * i + 0] >= 0)
+                {
+                    simFloat distanceData[7];
+                    // the distance between disjoint proxies bounds the
+                    // distance between the meshes from below:
+                    const simInt *handles = isProxyPair(i) && !areProxiesApart(i) ? &task->collisionPairExactHandles[2 * i] : &task->collisionPairCheckHandles[2 * i];
+                    int r = simCheckDistance(handles[0], handles[1], 0.0f, &distanceData[0]);
+                    collision_count++;
+                    task->collisionCheckCount++;
+                    if(r > 0)
+                    {
+                        dist = std::min(dist, (double)distanceData[6]);
+                    }
+                    else
+                    {
+                        unknown = true;
+                        // an error is not proof of a free state:
+                        if(simCheckCollision(task->collisionPairExactHandles[2 * i + 0], task->collisionPairExactHandles[2 * i + 1]) != 0)
+                            dist = 0.0;
+                    }
+                    if(dist <= 0.0)
+                    {
+                        recordCollisionPairHit(k);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // restore original state:
+        statespace->as<StateSpace>()->writeState(s_old);
+
+        if(dist <= 0.0)
+        {
+            dist = 0.0;
+            return false;
+        }
+        if(unknown)
+            dist = 0.0;
+        return true;
+    }
+
+    void countValidityChecks(unsigned long count) const
+    {
+        if(validityCheckCounter)
+            *validityCheckCounter += count;
+        else
+            task->validityCheckCount += count;
+    }
+
+    // whether the i-th pair is proven free by one of the map's levels of
+    // detail (see useMapLevelsOfDetail); distance checks don't use them, as
+    // they only bound the distance from below:
+    bool isFreeAtCoarseLevel(size_t i) const
+    {
+        simInt shape = task->collisionPairLevelShapes[i];
+        if(shape == -1 || task->collisionPairLevelsMap != mapcache::currentHash)
+            return false;
+        float bbox[6];
+        if(!shapeWorldBox(task, shape, bbox))
+            return false;
+        size_t count = std::min((size_t)task->mapLevelsOfDetail, mapcache::currentLevels.size());
+        for(size_t l = 0; l < count; l++)
+        {
+            const std::vector<float> &boxes = mapcache::currentLevels[l];
+            bool overlap = false;
+            for(size_t b = 0; b + 6 <= boxes.size() && !overlap; b += 6)
+                overlap = boundingBoxesOverlap(bbox, &boxes[b]);
+            if(!overlap)
+                return true;
+        }
+        return false;
+    }
+
+    // whether the i-th pair's convex proxies only serve to prove it free,
+    // everything else being checked with the exact meshes:
+    bool isProxyPair(size_t i) const
+    {
+        return task->collisionProxyExactFallback
+            && (task->collisionPairExactHandles[2 * i + 0] != task->collisionPairCheckHandles[2 * i + 0]
+                || task->collisionPairExactHandles[2 * i + 1] != task->collisionPairCheckHandles[2 * i + 1]);
+    }
+
+    // whether the bounding boxes of the i-th pair's entities (with their
+    // proxies) are disjoint. Proxies contain their meshes, so this proves the
+    // pair free; when they overlap, an obstacle may lie inside a proxy
+    // without crossing its surface, so only the exact meshes can tell:
+    bool areProxiesApart(size_t i) const
+    {
+        float bbox0[6], bbox1[6];
+        return shapeWorldBox(task, task->collisionPairCheckHandles[2 * i + 0], bbox0)
+            && shapeWorldBox(task, task->collisionPairCheckHandles[2 * i + 1], bbox1)
+            && !boundingBoxesOverlap(bbox0, bbox1);
+    }
+
+    // counts a collision found with the k-th pair of the checking order and,
+    // with adaptive ordering, moves that pair ahead of the previous one once
+    // it has collided more often (called with the scene lock held):
+    void recordCollisionPairHit(size_t k) const
+    {
+        std::vector<size_t> &order = task->collisionPairOrder;
+        std::vector<unsigned long> &hits = task->collisionPairHits;
+        hits[order[k]]++;
+        if(task->collisionPairOrdering != sim_ompl_collisionpairordering_fixed && k > 0 && hits[order[k]] > hits[order[k - 1]])
+            std::swap(order[k], order[k - 1]);
+    }
+
+    virtual bool checkCallback(const ob::State *state) const
+    {
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+        trace::Scope scope("stateValidationCallback");
+
+        bool ret = false;
+
+        stateToFloats(statespace, state, stateVec, in_args.state);
+
+        stateValidationCallback_out out_args;
+
+        if(stateValidationCallback(task->stateValidation.callback.scriptId, task->stateValidation.callback.function.c_str(), &in_args, &out_args))
+        {
+            ret = out_args.valid;
+        }
+        else
+        {
+            throw ompl::Exception("State validation callback " + task->stateValidation.callback.function + " returned an error");
+        }
+
+        return ret;
     }
 
-    virtual ~StateValidityChecker()
+    virtual bool checkNative(const ob::State *state) const
     {
+        trace::Scope scope("stateValidationNative");
+        // native functions run without the scene lock, hence per-thread buffers:
+        static thread_local std::vector<double> stateVec;
+        statespace->copyToReals(stateVec, state);
+        simOMPLStateValidationFn f = (simOMPLStateValidationFn)task->stateValidation.nativeCallback.address;
+        return f(stateVec.data(), stateVec.size()) != 0;
     }
 
-    virtual bool isValid(const ob::State *state) const
+    // the states are passed as a flat array of count * dim values, and the
+    // callback returns one boolean per state:
+    virtual bool checkBatchCallback(const ob::State *const *states, size_t count, std::vector<bool> &valid) const
     {
-        switch(task->stateValidation.type)
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+        trace::Scope scope("stateValidationBatchCallback");
+
+        batch_in_args.count = count;
+        batch_in_args.states.resize(count * task->dim);
+        for(size_t j = 0; j < count; j++)
         {
-        case TaskDef::StateValidation::DEFAULT:
-            return checkDefault(state);
-        case TaskDef::StateValidation::CLLBACK:
-            return checkCallback(state);
+            statespace->copyToReals(stateVec, states[j]);
+            for(size_t i = 0; i < stateVec.size(); i++)
+                batch_in_args.states[j * task->dim + i] = (float)stateVec[i];
         }
-        return false;
+
+        stateValidationBatchCallback_out out_args;
+
+        if(!stateValidationBatchCallback(task->stateValidation.callback.scriptId, task->stateValidation.callback.function.c_str(), &batch_in_args, &out_args))
+            throw ompl::Exception("State validation callback " + task->stateValidation.callback.function + " returned an error");
+        if(out_args.valid.size() != count)
+            throw ompl::Exception("State validation callback " + task->stateValidation.callback.function + " returned a wrong number of results");
+
+        valid.assign(out_args.valid.begin(), out_args.valid.end());
+        return true;
+    }
+
+    ob::StateSpacePtr statespace;
+    TaskDef *task;
+    // buffers reused across callback calls:
+    mutable std::vector<double> stateVec;
+    mutable stateValidationCallback_in in_args;
+    mutable stateValidationBatchCallback_in batch_in_args;
+};
+
+// uniform sampler for FMT and BITstar, which check the validity of each
+// uniform sample right after drawing it: samples are drawn in batches, and
+// the next batch is validated in the background (as one block for a batched
+// callback, otherwise split among threads) while the planner consumes the
+// current one. Validity checks that go through the scene are still
+// serialized by the scene lock, so the overlap pays off mostly with native
+// or batched validation.
+// The background validation only runs during solve() (between
+// startSampleBatches and stopSampleBatches), as the scene and Lua may only be
+// used from other threads while the main thread is blocked in a command;
+// outside of it, batches are validated on the calling thread.
+class BatchValidatingStateSampler : public ob::StateSampler
+{
+public:
+    BatchValidatingStateSampler(const ob::StateSpace *space, const ob::StateSamplerPtr &batchSampler, const ob::StateSamplerPtr &sampler, const StateValidityChecker *checker, TaskDef *task)
+        : ob::StateSampler(space), batchSampler(batchSampler), sampler(sampler), checker(checker), task(task), next(0)
+    {
+        for(int i = 0; i < task->sampleBatchSize; i++)
+        {
+            current.states.push_back(space->allocState());
+            pending.states.push_back(space->allocState());
+        }
+        current.valid.resize(task->sampleBatchSize);
+        pending.valid.resize(task->sampleBatchSize);
+        next = current.states.size();
+
+        std::lock_guard<std::mutex> lock(instancesMutex);
+        instances.push_back(this);
+    }
+
+    virtual ~BatchValidatingStateSampler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            instances.erase(std::find(instances.begin(), instances.end(), this));
+        }
+        if(prefetch.valid())
+            prefetch.wait();
+        for(size_t i = 0; i < current.states.size(); i++)
+        {
+            space_->freeState(current.states[i]);
+            space_->freeState(pending.states[i]);
+        }
+    }
+
+    virtual void sampleUniform(ob::State *state)
+    {
+        if(next == current.states.size())
+        {
+            if(prefetch.valid())
+                prefetch.get();
+            else
+                validateBatch(pending);
+            std::swap(current, pending);
+            next = 0;
+            if(task->sampleBatchPrefetch)
+                prefetch = std::async(std::launch::async, [this] { validateBatch(pending); });
+        }
+        space_->copyState(state, current.states[next]);
+        prevalidatedSample.space = space_;
+        space_->copyToReals(prevalidatedSample.values, state);
+        prevalidatedSample.valid = current.valid[next];
+        next++;
+    }
+
+    virtual void sampleUniformNear(ob::State *state, const ob::State *near, double distance)
+    {
+        sampler->sampleUniformNear(state, near, distance);
+    }
+
+    virtual void sampleGaussian(ob::State *state, const ob::State *mean, double stdDev)
+    {
+        sampler->sampleGaussian(state, mean, stdDev);
+    }
+
+    // waits for the batch being validated in the background, and drops the
+    // validated samples, which may not hold in another scene state:
+    void reset()
+    {
+        if(prefetch.valid())
+            prefetch.wait();
+        prefetch = std::future<void>();
+        next = current.states.size();
     }
 
 protected:
-    virtual bool checkDefault(const ob::State *state) const
+    friend void startSampleBatches(TaskDef *task);
+    friend void stopSampleBatches(TaskDef *task);
+
+    // the samplers alive, for startSampleBatches and stopSampleBatches:
+    static std::mutex instancesMutex;
+    static std::vector<BatchValidatingStateSampler *> instances;
+
+    struct Batch
     {
-        //ob::CompoundStateSpace *ss = statespace->as<ob::CompoundStateSpace>();
-        ob::ScopedState<ob::CompoundStateSpace> s(statespace);
-        s = state;
+        std::vector<ob::State *> states;
+        std::vector<char> valid;
+    };
 
-        // save old state:
-        ob::ScopedState<ob::CompoundStateSpace> s_old(statespace);
-        statespace->as<StateSpace>()->readState(s_old);
+    void validateBatch(Batch &batch)
+    {
+        trace::Scope scope("validateSampleBatch");
+        for(size_t i = 0; i < batch.states.size(); i++)
+            batchSampler->sampleUniform(batch.states[i]);
 
-        // write query state:
-        statespace->as<StateSpace>()->writeState(s);
+        if(task->stateValidation.type == TaskDef::StateValidation::BATCH_CLLBACK || task->sampleBatchThreadCount <= 1)
+        {
+            std::vector<bool> valid;
+            checker->isValid(batch.states.data(), batch.states.size(), valid);
+            for(size_t i = 0; i < batch.states.size(); i++)
+                batch.valid[i] = i < valid.size() && valid[i];
+            return;
+        }
 
-        // check collisions:
-        bool inCollision = false;
-        for(size_t i = 0; i < task->collisionPairHandles.size() / 2; i++)
+        // the first exception thrown by a thread (e.g. by a callback), which
+        // stops the others and is rethrown once they have returned:
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> threads;
+        size_t n = batch.states.size(), numThreads = task->sampleBatchThreadCount;
+        for(size_t t = 0; t < numThreads; t++)
         {
-            if(task->collisionPairHandles[2 * i + 0] >= 0)
+            threads.push_back(std::thread([&, t] {
+                try
+                {
+                    for(size_t i = n * t / numThreads; i < n * (t + 1) / numThreads && !failed; i++)
+                        batch.valid[i] = checker->isValid(batch.states[i]);
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if(!error)
+                        error = std::current_exception();
+                    failed = true;
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // draws the batches (only used by the validating thread):
+    ob::StateSamplerPtr batchSampler;
+    // for the other kinds of sampling:
+    ob::StateSamplerPtr sampler;
+    const StateValidityChecker *checker;
+    TaskDef *task;
+    Batch current, pending;
+    size_t next;
+    std::future<void> prefetch;
+};
+
+std::mutex BatchValidatingStateSampler::instancesMutex;
+std::vector<BatchValidatingStateSampler *> BatchValidatingStateSampler::instances;
+
+// lets the batch validating samplers of a task validate the next batch in the
+// background, starting from fresh batches:
+void startSampleBatches(TaskDef *task)
+{
+    std::lock_guard<std::mutex> lock(BatchValidatingStateSampler::instancesMutex);
+    for(size_t i = 0; i < BatchValidatingStateSampler::instances.size(); i++)
+        if(BatchValidatingStateSampler::instances[i]->task == task)
+            BatchValidatingStateSampler::instances[i]->reset();
+    task->sampleBatchPrefetch = true;
+}
+
+// stops the background validation started by startSampleBatches, once the
+// planner has returned:
+void stopSampleBatches(TaskDef *task)
+{
+    task->sampleBatchPrefetch = false;
+    std::lock_guard<std::mutex> lock(BatchValidatingStateSampler::instancesMutex);
+    for(size_t i = 0; i < BatchValidatingStateSampler::instances.size(); i++)
+        if(BatchValidatingStateSampler::instances[i]->task == task)
+            BatchValidatingStateSampler::instances[i]->reset();
+}
+
+ob::StateSamplerPtr StateSpace::allocDefaultStateSampler() const
+{
+    std::function<ob::StateSamplerPtr()> alloc = [this]() -> ob::StateSamplerPtr {
+        ob::StateSamplerPtr sampler = ob::CompoundStateSpace::allocDefaultStateSampler();
+        if(task->traceFile.empty())
+            return sampler;
+        return ob::StateSamplerPtr(new TracedStateSampler(this, sampler));
+    };
+
+    // batches only for the planner of this space (not e.g. for the collision
+    // pair analysis in setup(), which runs before the space information
+    // exists), and only if it's checked by our validity checker:
+    if(task->sampleBatchSize > 0 && task->portfolio.empty()
+            && (task->algorithm == sim_ompl_algorithm_FMT || task->algorithm == sim_ompl_algorithm_BITstar)
+            && task->spaceInformationPtr && task->spaceInformationPtr->getStateSpace().get() == this)
+    {
+        const StateValidityChecker *checker = dynamic_cast<const StateValidityChecker *>(task->spaceInformationPtr->getStateValidityChecker().get());
+        if(checker)
+            return ob::StateSamplerPtr(new BatchValidatingStateSampler(this, alloc(), alloc(), checker, task));
+    }
+    return alloc();
+}
+
+// validates motions like ompl::base::DiscreteMotionValidator, but checks all
+// the intermediate states of a motion as one block, so that a batched state
+// validation callback is called once per motion instead of once per state:
+class BatchMotionValidator : public ob::MotionValidator
+{
+public:
+    BatchMotionValidator(const ob::SpaceInformationPtr &si, TaskDef *task)
+        : ob::MotionValidator(si), statespace(si->getStateSpace()), task(task)
+    {
+    }
+
+    virtual bool checkMotion(const ob::State *s1, const ob::State *s2) const
+    {
+        std::pair<ob::State *, double> lastValid(nullptr, 0.0);
+        return checkMotion(s1, s2, lastValid);
+    }
+
+    virtual bool checkMotion(const ob::State *s1, const ob::State *s2, std::pair<ob::State *, double> &lastValid) const
+    {
+        // the states at the end of each segment, the last one being s2 (local
+        // to the call, as multithreaded planners check motions concurrently):
+        int nd = statespace->validSegmentCount(s1, s2);
+        std::vector<ob::State *> states(nd);
+        std::vector<bool> valid;
+        si_->allocStates(states);
+        for(int j = 1; j < nd; j++)
+            statespace->interpolate(s1, s2, (double)j / (double)nd, states[j - 1]);
+        si_->copyState(states[nd - 1], s2);
+
+        const StateValidityChecker *svc = static_cast<const StateValidityChecker *>(si_->getStateValidityChecker().get());
+        svc->isValid(&states[0], nd, valid);
+
+        bool result = true;
+        for(int j = 0; j < nd; j++)
+        {
+            if(!valid[j] || !si_->satisfiesBounds(states[j]))
             {
-                int r = simCheckCollision(task->collisionPairHandles[2 * i + 0], task->collisionPairHandles[2 * i + 1]);
-                collision_count++;
-                std::cout << "\nColiision Count is " <<collision_count<<std::endl;
-                if(r > 0)
+                lastValid.second = (double)j / (double)nd;
+                if(lastValid.first)
+                    statespace->interpolate(s1, s2, lastValid.second, lastValid.first);
+                result = false;
+                break;
+            }
+        }
+        si_->freeStates(states);
+
+        if(result)
+            valid_++;
+        else
+            invalid_++;
+        return result;
+    }
+
+protected:
+    ob::StateSpacePtr statespace;
+    TaskDef *task;
+};
+
+// validates motions by conservative advancement: the clearance measured at a
+// valid state, divided by an upper bound on how far any point of the robot can
+// move along the motion, gives an interval of the motion that is guaranteed to
+// be collision free, so it can be skipped without further checks.
+// Steps are never shorter than the state validity checking resolution, hence
+// near obstacles this behaves like ompl::base::DiscreteMotionValidator: where
+// the clearance is smaller than a step, the motion is only checked at that
+// resolution, and an obstacle thinner than a step can fit between two checked
+// states. Lower the resolution if that matters.
+class MotionValidator : public ob::MotionValidator
+{
+public:
+    MotionValidator(const ob::SpaceInformationPtr &si, TaskDef *task)
+        : ob::MotionValidator(si), statespace(si->getStateSpace()), task(task)
+    {
+        computeMotionRadii();
+    }
+
+    virtual bool checkMotion(const ob::State *s1, const ob::State *s2) const
+    {
+        const ob::StateValidityCheckerPtr &svc = si_->getStateValidityChecker();
+
+        // s1 is assumed to be valid, but we need its clearance:
+        double da = 0.0, db = 0.0;
+        svc->isValid(s1, da);
+        if(!si_->satisfiesBounds(s2) || !svc->isValid(s2, db))
+        {
+            invalid_++;
+            return false;
+        }
+
+        double displacement = maxDisplacement(s1, s2);
+        double minStep = 1.0 / (double)statespace->validSegmentCount(s1, s2);
+        bool result = true;
+
+        if(displacement > 0.0)
+        {
+            // advance from both ends, until the two safe intervals overlap:
+            ob::State *test = si_->allocState();
+            double a = 0.0, b = 1.0;
+            while(true)
+            {
+                a += std::max(da / displacement, minStep);
+                b -= std::max(db / displacement, minStep);
+                if(a >= b) break;
+
+                statespace->interpolate(s1, s2, a, test);
+                if(!si_->satisfiesBounds(test) || !svc->isValid(test, da))
+                {
+                    result = false;
+                    break;
+                }
+
+                statespace->interpolate(s1, s2, b, test);
+                if(!si_->satisfiesBounds(test) || !svc->isValid(test, db))
                 {
-                    inCollision = true;
+                    result = false;
                     break;
                 }
             }
-            if(inCollision) break;
+            si_->freeState(test);
         }
 
-        // restore original state:
-        statespace->as<StateSpace>()->writeState(s_old);
+        if(result)
+            valid_++;
+        else
+            invalid_++;
 
-        return !inCollision;
+        return result;
     }
 
-    virtual bool checkCallback(const ob::State *state) const
+    virtual bool checkMotion(const ob::State *s1, const ob::State *s2, std::pair<ob::State *, double> &lastValid) const
     {
-        std::vector<double> stateVec;
-        statespace->copyToReals(stateVec, state);
+        const ob::StateValidityCheckerPtr &svc = si_->getStateValidityChecker();
 
-        bool ret = false;
+        double d = 0.0;
+        svc->isValid(s1, d);
 
-        stateValidationCallback_in in_args;
-        stateValidationCallback_out out_args;
+        double displacement = maxDisplacement(s1, s2);
+        double minStep = 1.0 / (double)statespace->validSegmentCount(s1, s2);
+        bool result = true;
 
-        for(size_t i = 0; i < stateVec.size(); i++)
-            in_args.state.push_back((float)stateVec[i]);
+        // advance from s1 towards s2; t is the last verified valid point:
+        ob::State *test = si_->allocState();
+        double t = 0.0;
+        while(true)
+        {
+            double next = displacement > 0.0 ? t + std::max(d / displacement, minStep) : 1.0;
+            if(next >= 1.0)
+            {
+                if(!si_->satisfiesBounds(s2) || !svc->isValid(s2, d))
+                    result = false;
+                break;
+            }
 
-        if(stateValidationCallback(task->stateValidation.callback.scriptId, task->stateValidation.callback.function.c_str(), &in_args, &out_args))
+            statespace->interpolate(s1, s2, next, test);
+            if(!si_->satisfiesBounds(test) || !svc->isValid(test, d))
+            {
+                result = false;
+                break;
+            }
+            t = next;
+        }
+        si_->freeState(test);
+
+        if(result)
         {
-            ret = out_args.valid;
+            valid_++;
         }
         else
         {
-            throw ompl::Exception("State validation callback " + task->stateValidation.callback.function + " returned an error");
+            lastValid.second = t;
+            if(lastValid.first)
+                statespace->interpolate(s1, s2, t, lastValid.first);
+            invalid_++;
         }
 
-        return ret;
+        return result;
+    }
+
+protected:
+    // upper bound on the distance travelled by any point of the robot
+    // while moving along the (interpolated) motion from s1 to s2:
+    double maxDisplacement(const ob::State *s1, const ob::State *s2) const
+    {
+        const ob::CompoundState *a = s1->as<ob::CompoundStateSpace::StateType>();
+        const ob::CompoundState *b = s2->as<ob::CompoundStateSpace::StateType>();
+
+        double d = 0.0;
+
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+
+            switch(stateSpace->type)
+            {
+            case sim_ompl_statespacetype_pose2d:
+                {
+                    const ob::SE2StateSpace::StateType *p = a->as<ob::SE2StateSpace::StateType>(i);
+                    const ob::SE2StateSpace::StateType *q = b->as<ob::SE2StateSpace::StateType>(i);
+                    double yaw = std::fabs(q->getYaw() - p->getYaw());
+                    if(yaw > M_PI) yaw = 2.0 * M_PI - yaw;
+                    d += std::hypot(q->getX() - p->getX(), q->getY() - p->getY()) + motionRadius[i] * yaw;
+                }
+                break;
+            case sim_ompl_statespacetype_pose3d:
+                {
+                    const ob::SE3StateSpace::StateType *p = a->as<ob::SE3StateSpace::StateType>(i);
+                    const ob::SE3StateSpace::StateType *q = b->as<ob::SE3StateSpace::StateType>(i);
+                    double dx = q->getX() - p->getX(), dy = q->getY() - p->getY(), dz = q->getZ() - p->getZ();
+                    double dot = std::fabs(p->rotation().x * q->rotation().x + p->rotation().y * q->rotation().y + p->rotation().z * q->rotation().z + p->rotation().w * q->rotation().w);
+                    double angle = 2.0 * std::acos(std::min(1.0, dot));
+                    d += std::sqrt(dx * dx + dy * dy + dz * dz) + motionRadius[i] * angle;
+                }
+                break;
+            case sim_ompl_statespacetype_position2d:
+            case sim_ompl_statespacetype_position3d:
+                d += statespace->as<ob::CompoundStateSpace>()->getSubspace(i)->distance(a->components[i], b->components[i]);
+                break;
+            case sim_ompl_statespacetype_joint_position:
+                d += motionRadius[i] * std::fabs(b->as<ob::RealVectorStateSpace::StateType>(i)->values[0] - a->as<ob::RealVectorStateSpace::StateType>(i)->values[0]);
+                break;
+            case sim_ompl_statespacetype_dubins:
+                {
+                    // the dubins path length bounds both the travelled distance
+                    // and (divided by the turning radius) the rotation:
+                    double len = statespace->as<ob::CompoundStateSpace>()->getSubspace(i)->distance(a->components[i], b->components[i]);
+                    d += len * (1.0 + motionRadius[i] / stateSpace->dubinsTurningRadius);
+                }
+                break;
+            }
+        }
+
+        return d;
+    }
+
+    void computeMotionRadii()
+    {
+        motionRadius.resize(task->stateSpaces.size());
+
+        for(size_t i = 0; i < task->stateSpaces.size(); i++)
+        {
+            StateSpaceDef *stateSpace = statespaces[task->stateSpaces[i]];
+
+            if(stateSpace->type == sim_ompl_statespacetype_joint_position && simGetJointType(stateSpace->objectHandle) == sim_joint_prismatic_subtype)
+                motionRadius[i] = 1.0; // pure translation
+            else
+                motionRadius[i] = treeReach(stateSpace->objectHandle, stateSpace->objectHandle, false);
+        }
     }
 
     ob::StateSpacePtr statespace;
     TaskDef *task;
+    // for each state space component, the max distance travelled by a point
+    // of the robot per unit of rotation (or translation for prismatic joints):
+    std::vector<double> motionRadius;
 };
 
-class Goal : public ob::Goal
+// goal region for dummy pair and callback goals. When the robot dummy's pose
+// can be computed natively, goal states are also produced by a numeric IK
+// solver (damped least squares, with random restarts) running in a background
+// thread, so that bidirectional planners can grow trees from the goal. The
+// IK thread doesn't touch the scene: validity of the produced states is
+// checked by the planners when they take them.
+class Goal : public ob::GoalSampleableRegion
 {
 public:
     Goal(const ob::SpaceInformationPtr &si, TaskDef *task, double tolerance = 1e-3)
-        : ob::Goal(si), statespace(si->getStateSpace()), task(task), tolerance(tolerance)
+        : ob::GoalSampleableRegion(si), statespace(si->getStateSpace()), task(task), tolerance(tolerance), nativeDummyPair(false), stopIK(false), runningIK(false)
+    {
+        threshold_ = tolerance;
+        for(int i = 0; i < 4; i++)
+            metric[i] = task->goal.metric[i];
+
+        // if the goal dummy stays put and the robot dummy's pose can be
+        // computed from the state, the goal check doesn't need the scene:
+        if(task->goal.type == TaskDef::Goal::DUMMY_PAIR && task->robotDummyChain && task->robotDummyChain->isValid() && !isMovedByState(task, task->goal.dummyPair.goalDummy))
+        {
+            simFloat m[12];
+            simGetObjectMatrix(task->goal.dummyPair.goalDummy, task->goal.refDummy, &m[0]);
+            std::copy(m, m + 12, goalMatrix);
+            chain = task->robotDummyChain;
+            nativeDummyPair = true;
+        }
+    }
+
+    virtual ~Goal()
+    {
+        stopSampling();
+        for(size_t i = 0; i < solutions.size(); i++)
+            si_->freeState(solutions[i]);
+    }
+
+    // starts producing goal states in the background (only with native
+    // dummy pair goals). The space information must be set up.
+    void startSampling()
+    {
+        if(!nativeDummyPair) return;
+
+        stopSampling();
+        if(maxSampleCount() >= maxIKSolutions) return;
+
+        stopIK = false;
+        runningIK = true;
+        ikThread = std::thread(&Goal::sampleIK, this);
+    }
+
+    void stopSampling()
+    {
+        stopIK = true;
+        if(ikThread.joinable())
+            ikThread.join();
+        runningIK = false;
+    }
+
+    virtual void sampleGoal(ob::State *state) const
+    {
+        std::lock_guard<std::mutex> lock(solutionsMutex);
+        if(solutions.empty())
+            throw ompl::Exception("There are no goal states to sample");
+        si_->copyState(state, solutions[rng.uniformInt(0, solutions.size() - 1)]);
+    }
+
+    virtual unsigned int maxSampleCount() const
+    {
+        std::lock_guard<std::mutex> lock(solutionsMutex);
+        return solutions.size();
+    }
+
+    virtual bool couldSample() const
+    {
+        return runningIK || canSample();
+    }
+
+    virtual double distanceGoal(const ob::State *state) const
     {
+        double distance = 0.0;
+        isSatisfied(state, &distance);
+        return distance;
     }
 
     virtual bool isSatisfied(const ob::State *state) const
@@ -733,6 +3240,8 @@ public:
 
     virtual bool isSatisfied(const ob::State *state, double *distance) const
     {
+        trace::Scope scope("isSatisfied");
+
         switch(task->goal.type)
         {
         case TaskDef::Goal::STATE:
@@ -743,6 +3252,8 @@ public:
             return checkDummyPair(state, distance);
         case TaskDef::Goal::CLLBACK:
             return checkCallback(state, distance);
+        case TaskDef::Goal::NATIVE:
+            return checkNative(state, distance);
         }
 
         return false;
@@ -751,6 +3262,11 @@ public:
 protected:
     virtual bool checkDummyPair(const ob::State *state, double *distance) const
     {
+        if(nativeDummyPair)
+            return checkDummyPairNative(state, distance);
+
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
         ob::ScopedState<ob::CompoundStateSpace> s(statespace);
         s = state;
 
@@ -781,26 +3297,185 @@ protected:
             *distance = sqrt(pow((goalM[3] - robotM[3])*task->goal.metric[0], 2) + pow((goalM[7] - robotM[7])*task->goal.metric[1], 2) + pow((goalM[11] - robotM[11])*task->goal.metric[2], 2) + pow(angle*task->goal.metric[3], 2));
         }
 
-        bool satisfied = *distance <= tolerance;
+        bool satisfied = *distance <= tolerance;
+
+        // restore original state:
+        statespace->as<StateSpace>()->writeState(s_old);
+
+        return satisfied;
+    }
+
+    virtual bool checkDummyPairNative(const ob::State *state, double *distance) const
+    {
+        double e[6];
+        *distance = poseError(state, e);
+        return *distance <= tolerance;
+    }
+
+    // weighted error between the goal dummy and the robot dummy poses, as a
+    // translation (x, y, z) and rotation vector, both expressed in the ref.
+    // dummy frame; returns the norm of the error, i.e. the goal distance:
+    double poseError(const ob::State *state, double *e) const
+    {
+        const double *g = goalMatrix;
+        double r[12];
+        chain->tipPose(state, r);
+
+        for(int i = 0; i < 3; i++)
+            e[i] = (g[4 * i + 3] - r[4 * i + 3]) * metric[i];
+
+        e[3] = e[4] = e[5] = 0.0;
+        if(metric[3] != 0.0)
+        { // do not ignore orientation
+            // rotation from the robot dummy to the goal dummy: Rg * Rr^T
+            double m[3][3];
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    m[i][j] = g[4 * i + 0] * r[4 * j + 0] + g[4 * i + 1] * r[4 * j + 1] + g[4 * i + 2] * r[4 * j + 2];
+            double angle = KinematicChain::rotationAngle(r, g);
+            double v[3] = {m[2][1] - m[1][2], m[0][2] - m[2][0], m[1][0] - m[0][1]};
+            double sa = std::sin(angle);
+            double k = sa > 1e-9 ? angle / (2.0 * sa) : 0.5;
+            for(int i = 0; i < 3; i++)
+                e[3 + i] = v[i] * k * metric[3];
+        }
+
+        return sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2] + e[3] * e[3] + e[4] * e[4] + e[5] * e[5]);
+    }
+
+    // body of the IK thread:
+    void sampleIK()
+    {
+        ob::StateSamplerPtr sampler = si_->allocStateSampler();
+        ob::State *state = si_->allocState();
+
+        while(!stopIK && maxSampleCount() < maxIKSolutions)
+        {
+            sampler->sampleUniform(state);
+            if(!solveIK(state))
+                continue;
+
+            std::lock_guard<std::mutex> lock(solutionsMutex);
+            bool different = true;
+            for(size_t i = 0; i < solutions.size() && different; i++)
+            {
+                if(si_->distance(solutions[i], state) < minIKSolutionDistance)
+                    different = false;
+            }
+            if(different)
+                solutions.push_back(si_->cloneState(state));
+        }
+
+        si_->freeState(state);
+        runningIK = false;
+    }
+
+    // moves the given state towards the goal pose; returns true on success:
+    bool solveIK(ob::State *state) const
+    {
+        std::vector<int> components = chain->jointComponents();
+        size_t n = components.size();
+        if(n == 0) return false;
+
+        ob::CompoundState *s = state->as<ob::CompoundStateSpace::StateType>();
+        std::vector<double> J(6 * n);
+        double e[6], ek[6];
+        const double h = 1e-6, lambda2 = 1e-4;
+
+        for(int it = 0; it < maxIKIterations && !stopIK; it++)
+        {
+            if(poseError(state, e) <= tolerance)
+                return si_->satisfiesBounds(state);
+
+            // numeric jacobian of the robot dummy pose:
+            for(size_t k = 0; k < n; k++)
+            {
+                double &q = s->as<ob::RealVectorStateSpace::StateType>(components[k])->values[0];
+                q += h;
+                poseError(state, ek);
+                q -= h;
+                for(int i = 0; i < 6; i++)
+                    J[i * n + k] = (e[i] - ek[i]) / h;
+            }
+
+            // damped least squares: dq = J^T (J J^T + lambda^2 I)^-1 e
+            double A[6][7];
+            for(int i = 0; i < 6; i++)
+            {
+                for(int j = 0; j < 6; j++)
+                {
+                    A[i][j] = i == j ? lambda2 : 0.0;
+                    for(size_t k = 0; k < n; k++)
+                        A[i][j] += J[i * n + k] * J[j * n + k];
+                }
+                A[i][6] = e[i];
+            }
+            double y[6];
+            if(!solve6(A, y))
+                return false;
+
+            for(size_t k = 0; k < n; k++)
+            {
+                double dq = 0.0;
+                for(int i = 0; i < 6; i++)
+                    dq += J[i * n + k] * y[i];
+                s->as<ob::RealVectorStateSpace::StateType>(components[k])->values[0] += dq;
+            }
+            si_->enforceBounds(state);
+        }
+
+        return false;
+    }
 
-        // restore original state:
-        statespace->as<StateSpace>()->writeState(s_old);
+    // solves the 6x6 linear system in the augmented matrix A (gaussian elimination):
+    static bool solve6(double A[6][7], double *x)
+    {
+        for(int c = 0; c < 6; c++)
+        {
+            int pivot = c;
+            for(int r = c + 1; r < 6; r++)
+                if(std::fabs(A[r][c]) > std::fabs(A[pivot][c]))
+                    pivot = r;
+            if(std::fabs(A[pivot][c]) < 1e-12)
+                return false;
+            for(int j = 0; j < 7; j++)
+                std::swap(A[c][j], A[pivot][j]);
+            for(int r = c + 1; r < 6; r++)
+            {
+                double f = A[r][c] / A[c][c];
+                for(int j = c; j < 7; j++)
+                    A[r][j] -= f * A[c][j];
+            }
+        }
+        for(int r = 5; r >= 0; r--)
+        {
+            x[r] = A[r][6];
+            for(int j = r + 1; j < 6; j++)
+                x[r] -= A[r][j] * x[j];
+            x[r] /= A[r][r];
+        }
+        return true;
+    }
 
-        return satisfied;
+    virtual bool checkNative(const ob::State *state, double *distance) const
+    {
+        // native functions run without the scene lock, hence per-thread buffers:
+        static thread_local std::vector<double> stateVec;
+        statespace->copyToReals(stateVec, state);
+        simOMPLGoalFn f = (simOMPLGoalFn)task->goal.nativeCallback.address;
+        return f(stateVec.data(), stateVec.size(), distance) != 0;
     }
 
     virtual bool checkCallback(const ob::State *state, double *distance) const
     {
-        std::vector<double> stateVec;
-        statespace->copyToReals(stateVec, state);
+        std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+        trace::Scope scope("goalCallback");
 
         bool ret = false;
 
-        goalCallback_in in_args;
-        goalCallback_out out_args;
+        stateToFloats(statespace, state, stateVec, in_args.state);
 
-        for(size_t i = 0; i < stateVec.size(); i++)
-            in_args.state.push_back((float)stateVec[i]);
+        goalCallback_out out_args;
 
         if(goalCallback(task->goal.callback.scriptId, task->goal.callback.function.c_str(), &in_args, &out_args))
         {
@@ -818,26 +3493,277 @@ protected:
     ob::StateSpacePtr statespace;
     TaskDef *task;
     double tolerance;
+    // goal metric (copied, as the IK thread may outlive a change of the task):
+    double metric[4];
+    // goal dummy pose (relative to the ref. dummy), when nativeDummyPair is set:
+    double goalMatrix[12];
+    std::shared_ptr<KinematicChain> chain;
+    bool nativeDummyPair;
+    // IK sampling:
+    static const unsigned int maxIKSolutions = 100;
+    static const int maxIKIterations = 100;
+    static constexpr double minIKSolutionDistance = 1e-2;
+    std::thread ikThread;
+    std::atomic<bool> stopIK;
+    std::atomic<bool> runningIK;
+    mutable std::mutex solutionsMutex;
+    std::vector<ob::State *> solutions;
+    mutable ompl::RNG rng;
+    // buffers reused across callback calls:
+    mutable std::vector<double> stateVec;
+    mutable goalCallback_in in_args;
+};
+
+// valid uniform samples produced ahead of time by background threads (each
+// rejection sampling with its own sampler), for the default valid state
+// sampler to take instead of sampling inline. The samples are kept in a
+// bounded lock-free queue (Vyukov's MPMC ring buffer: each slot carries a
+// sequence number telling whether it is ready to be written or read). The
+// producers only run between start() and stop(), i.e. during solve(). Their
+// validity checks are counted by the pool, not in the task's
+// validityCheckCount.
+class ValidSamplePool
+{
+public:
+    ValidSamplePool(const ob::SpaceInformationPtr &si, size_t depth, unsigned int threadCount)
+        : si(si), threadCount(threadCount), capacity(1), enqueuePos(0), dequeuePos(0), stopping(false), hits(0), misses(0), checks(0)
+    {
+        while(capacity < depth)
+            capacity *= 2;
+        slots.reset(new Slot[capacity]);
+        for(size_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~ValidSamplePool()
+    {
+        stop();
+    }
+
+    // starts the producers with an empty pool (samples validated before may
+    // not hold in the current scene):
+    void start()
+    {
+        stop();
+        enqueuePos = 0;
+        dequeuePos = 0;
+        for(size_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        stopping = false;
+        hits = 0;
+        misses = 0;
+        checks = 0;
+        error = std::exception_ptr();
+        for(unsigned int t = 0; t < threadCount; t++)
+            threads.push_back(std::thread(&ValidSamplePool::produce, this));
+    }
+
+    void stop()
+    {
+        stopping = true;
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        threads.clear();
+    }
+
+    // rethrows the first exception thrown by a producer (e.g. by a callback)
+    // since start(); call after stop():
+    void rethrowError()
+    {
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // takes a sample (as reals), counting a hit, or counts a miss if the pool
+    // is empty:
+    bool pop(std::vector<double> &values)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for(;;)
+        {
+            slot = &slots[pos & (capacity - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+            if(diff == 0)
+            {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                misses++;
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        values = slot->values;
+        slot->sequence.store(pos + capacity, std::memory_order_release);
+        hits++;
+        return true;
+    }
+
+    // number of samples ready (approximate while producers run):
+    size_t depth() const
+    {
+        return enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed);
+    }
+
+    unsigned long hitCount() const { return hits; }
+    unsigned long missCount() const { return misses; }
+    unsigned long checkCount() const { return checks; }
+
+protected:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        std::vector<double> values;
+    };
+
+    bool push(const std::vector<double> &values)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for(;;)
+        {
+            slot = &slots[pos & (capacity - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+            if(diff == 0)
+            {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->values = values;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    void produce()
+    {
+        trace::Scope scope("validSamplePool");
+        validityCheckCounter = &checks;
+        ob::UniformValidStateSampler sampler(si.get());
+        ob::State *state = si->allocState();
+        std::vector<double> values;
+        try
+        {
+            while(!stopping)
+            {
+                if(depth() >= capacity)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    continue;
+                }
+                if(!sampler.sample(state))
+                    continue;
+                si->getStateSpace()->copyToReals(values, state);
+                while(!push(values) && !stopping)
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        catch(...)
+        {
+            // stops the other producers too:
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if(!error)
+                error = std::current_exception();
+            stopping = true;
+        }
+        si->freeState(state);
+        validityCheckCounter = nullptr;
+    }
+
+    ob::SpaceInformationPtr si;
+    unsigned int threadCount;
+    size_t capacity; // a power of two
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t> enqueuePos;
+    std::atomic<size_t> dequeuePos;
+    std::atomic<bool> stopping;
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> checks;
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    std::mutex errorMutex;
 };
 
 class ValidStateSampler : public ob::UniformValidStateSampler
 {
 public:
     ValidStateSampler(const ob::SpaceInformation *si, TaskDef *task)
-        : ob::UniformValidStateSampler(si), task(task)
+        : ob::UniformValidStateSampler(si), task(task), batchPos(0), candidatePos(0)
     {
         name_ = "VREPValidStateSampler";
+
+        if(task->validStateSampling.type == TaskDef::ValidStateSampling::DEFAULT)
+        {
+            switch(task->validStateSampling.samplerType)
+            {
+            case sim_ompl_validstatesamplertype_obstacle_based:
+                builtin.reset(new ob::ObstacleBasedValidStateSampler(si));
+                break;
+            case sim_ompl_validstatesamplertype_maximize_clearance:
+                builtin.reset(new ob::MaximizeClearanceValidStateSampler(si));
+                break;
+            case sim_ompl_validstatesamplertype_gaussian:
+            case sim_ompl_validstatesamplertype_bridge_test:
+                checker = dynamic_cast<const StateValidityChecker *>(si->getStateValidityChecker().get());
+                stateSampler = si->allocStateSampler();
+                // as OMPL's Gaussian and bridge-test samplers:
+                stdDev = si->getMaximumExtent() * 0.1;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    virtual ~ValidStateSampler()
+    {
+        for(size_t i = 0; i < candidates.size(); i++)
+            si_->freeState(candidates[i]);
     }
 
     bool sample(ob::State *state)
     {
-        if(task->validStateSampling.type == TaskDef::ValidStateSampling::CLLBACK)
+        trace::Scope scope("sampleValid");
+
+        if(task->validStateSampling.type == TaskDef::ValidStateSampling::NATIVE)
+        {
+            stateVec.resize(task->dim);
+            simOMPLValidStateSamplerFn f = (simOMPLValidStateSamplerFn)task->validStateSampling.nativeCallback.address;
+            if(!f(stateVec.data(), stateVec.size()))
+                return false;
+            task->stateSpacePtr->copyFromReals(state, stateVec);
+            return true;
+        }
+        else if(task->validStateSampling.type == TaskDef::ValidStateSampling::BATCH_CLLBACK)
+        {
+            return sampleBatch(state);
+        }
+        else if(task->validStateSampling.type == TaskDef::ValidStateSampling::CLLBACK)
         {
             if(task->validStateSampling.callback.function == "")
             {
                 throw ompl::Exception("Specified empty callback for valid state sampling");
             }
 
+            std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
             bool ret = false;
 
             validStateSamplerCallback_in in_args;
@@ -845,9 +3771,7 @@ public:
 
             if(validStateSamplerCallback(task->validStateSampling.callback.scriptId, task->validStateSampling.callback.function.c_str(), &in_args, &out_args))
             {
-                std::vector<double> stateVec;
-                for(size_t i = 0; i < out_args.sampledState.size(); i++)
-                    stateVec.push_back((double)out_args.sampledState[i]);
+                stateVec.assign(out_args.sampledState.begin(), out_args.sampledState.end());
                 task->stateSpacePtr->copyFromReals(state, stateVec);
                 ret = true;
             }
@@ -860,36 +3784,61 @@ public:
         }
         else
         {
-            return ob::UniformValidStateSampler::sample(state);
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            bool ret;
+            if(builtin)
+                ret = builtin->sample(state);
+            else if(checker)
+                ret = sampleCandidates(state);
+            else if(task->validSamplePool && task->validSamplePool->pop(stateVec))
+            {
+                task->stateSpacePtr->copyFromReals(state, stateVec);
+                ret = true;
+            }
+            else
+                ret = ob::UniformValidStateSampler::sample(state);
+            task->validStateSampling.calls++;
+            if(ret)
+                task->validStateSampling.accepted++;
+            task->validStateSampling.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+            return ret;
         }
     }
 
     bool sampleNear(ob::State *state, const ob::State *nearState, const double distance)
     {
-        if(task->validStateSampling.type == TaskDef::ValidStateSampling::CLLBACK)
+        trace::Scope scope("sampleValidNear");
+
+        if(task->validStateSampling.type == TaskDef::ValidStateSampling::NATIVE)
+        {
+            task->stateSpacePtr->copyToReals(nearStateVec, nearState);
+            stateVec.resize(task->dim);
+            simOMPLValidStateSamplerNearFn f = (simOMPLValidStateSamplerNearFn)task->validStateSampling.nativeCallbackNear.address;
+            if(!f(stateVec.data(), nearStateVec.data(), stateVec.size(), distance))
+                return false;
+            task->stateSpacePtr->copyFromReals(state, stateVec);
+            return true;
+        }
+        else if(task->validStateSampling.type != TaskDef::ValidStateSampling::DEFAULT)
         {
             if(task->validStateSampling.callbackNear.function == "")
             {
                 throw ompl::Exception("Specified empty callback for \"near\" valid state sampling");
             }
 
-            std::vector<double> nearStateVec;
-            task->stateSpacePtr->copyToReals(nearStateVec, nearState);
+            std::lock_guard<std::recursive_mutex> lock(sceneMutex);
 
             bool ret = false;
 
             validStateSamplerCallbackNear_in in_args;
             validStateSamplerCallbackNear_out out_args;
 
-            for(size_t i = 0; i < nearStateVec.size(); i++)
-                in_args.state.push_back((float)nearStateVec[i]);
+            stateToFloats(task->stateSpacePtr, nearState, stateVec, in_args.state);
             in_args.distance = distance;
 
             if(validStateSamplerCallbackNear(task->validStateSampling.callbackNear.scriptId, task->validStateSampling.callbackNear.function.c_str(), &in_args, &out_args))
             {
-                std::vector<double> stateVec;
-                for(size_t i = 0; i < out_args.sampledState.size(); i++)
-                    stateVec.push_back((double)out_args.sampledState[i]);
+                stateVec.assign(out_args.sampledState.begin(), out_args.sampledState.end());
                 task->stateSpacePtr->copyFromReals(state, stateVec);
                 ret = true;
             }
@@ -900,6 +3849,10 @@ public:
 
             return ret;
         }
+        else if(builtin)
+        {
+            return builtin->sampleNear(state, nearState, distance);
+        }
         else
         {
             return ob::UniformValidStateSampler::sampleNear(state, nearState, distance);
@@ -907,7 +3860,117 @@ public:
     }
 
 protected:
+    // Gaussian and bridge-test sampling, checking a block of candidates at
+    // once (one Lua call with a batched validation callback). Gaussian: a
+    // uniform state and a state near it, of which exactly one is valid,
+    // give the valid one (a state close to an obstacle). Bridge test: two
+    // such states that are both invalid give their midpoint, if valid (a
+    // state between two obstacles, i.e. in a narrow passage). The accepted
+    // states of a block are handed out one per call; returns false if a
+    // whole block yields none.
+    bool sampleCandidates(ob::State *state)
+    {
+        size_t n = task->validStateSampling.candidateBatchSize;
+        if(candidatePos >= ready.size())
+        {
+            // uniform states, then the states near them, then midpoints:
+            if(candidates.size() != 3 * n)
+            {
+                for(size_t i = 0; i < candidates.size(); i++)
+                    si_->freeState(candidates[i]);
+                candidates.resize(3 * n);
+                for(size_t i = 0; i < candidates.size(); i++)
+                    candidates[i] = si_->allocState();
+            }
+            for(size_t i = 0; i < n; i++)
+            {
+                stateSampler->sampleUniform(candidates[i]);
+                stateSampler->sampleGaussian(candidates[n + i], candidates[i], stdDev);
+            }
+            checker->isValid(candidates.data(), 2 * n, candidateValid);
+
+            ready.clear();
+            candidatePos = 0;
+            if(task->validStateSampling.samplerType == sim_ompl_validstatesamplertype_gaussian)
+            {
+                for(size_t i = 0; i < n; i++)
+                {
+                    if(candidateValid[i] != candidateValid[n + i])
+                        ready.push_back(candidateValid[i] ? i : n + i);
+                }
+            }
+            else
+            {
+                std::vector<const ob::State *> midpoints;
+                std::vector<size_t> index;
+                for(size_t i = 0; i < n; i++)
+                {
+                    if(candidateValid[i] || candidateValid[n + i])
+                        continue;
+                    si_->getStateSpace()->interpolate(candidates[i], candidates[n + i], 0.5, candidates[2 * n + i]);
+                    midpoints.push_back(candidates[2 * n + i]);
+                    index.push_back(2 * n + i);
+                }
+                if(!midpoints.empty())
+                    checker->isValid(midpoints.data(), midpoints.size(), candidateValid);
+                for(size_t i = 0; i < midpoints.size(); i++)
+                {
+                    if(candidateValid[i])
+                        ready.push_back(index[i]);
+                }
+            }
+            if(ready.empty())
+                return false;
+        }
+        si_->copyState(state, candidates[ready[candidatePos++]]);
+        return true;
+    }
+
+    // takes the next state of the block returned by the batched callback,
+    // requesting a new block when all states have been used:
+    bool sampleBatch(ob::State *state)
+    {
+        if(batchPos >= batch.size())
+        {
+            std::lock_guard<std::recursive_mutex> lock(sceneMutex);
+
+            validStateSamplerBatchCallback_in in_args;
+            validStateSamplerBatchCallback_out out_args;
+            in_args.count = task->validStateSampling.batchSize;
+
+            if(!validStateSamplerBatchCallback(task->validStateSampling.callback.scriptId, task->validStateSampling.callback.function.c_str(), &in_args, &out_args))
+                throw ompl::Exception("Valid state sampling callback " + task->validStateSampling.callback.function + " returned an error");
+            if(out_args.sampledStates.size() < task->dim || out_args.sampledStates.size() % task->dim != 0)
+                throw ompl::Exception("Valid state sampling callback " + task->validStateSampling.callback.function + " returned an incomplete block of states");
+
+            batch.assign(out_args.sampledStates.begin(), out_args.sampledStates.end());
+            batchPos = 0;
+        }
+
+        stateVec.assign(batch.begin() + batchPos, batch.begin() + batchPos + task->dim);
+        batchPos += task->dim;
+        task->stateSpacePtr->copyFromReals(state, stateVec);
+        return true;
+    }
+
     TaskDef *task;
+    // buffers reused across callback calls:
+    std::vector<double> stateVec;
+    std::vector<double> nearStateVec;
+    // states returned by the batched callback, not yet used:
+    std::vector<double> batch;
+    size_t batchPos;
+    // obstacle-based and maximize-clearance samplers:
+    ob::ValidStateSamplerPtr builtin;
+    // for the Gaussian and bridge-test samplers:
+    const StateValidityChecker *checker = nullptr;
+    ob::StateSamplerPtr stateSampler;
+    double stdDev = 0.0;
+    std::vector<ob::State *> candidates;
+    std::vector<bool> candidateValid;
+    // indices in candidates of the accepted states, and the next to use:
+    std::vector<size_t> ready;
+    size_t candidatePos;
 };
 
 typedef std::shared_ptr<ValidStateSampler> ValidStateSamplerPtr;
@@ -976,9 +4039,44 @@ void createTask(SScriptCallBack *p, const char *cmd, createTask_in *in, createTa
     task->goal.type = TaskDef::Goal::STATE;
     task->stateValidation.type = TaskDef::StateValidation::DEFAULT;
     task->stateValidityCheckingResolution = 0.01f; // 1% of state space's extent
+    task->motionValidationType = sim_ompl_motionvalidationtype_discrete;
+    task->collisionPairOrdering = sim_ompl_collisionpairordering_fixed;
+    task->collisionPairAnalysisSamples = 0;
+    task->workspaceCullingSamples = 0;
+    task->workspaceCullingMargin = 0.05;
+    task->collisionProxyHullCount = 0;
+    task->collisionProxyMargin = 0.005;
+    task->collisionProxyExactFallback = true;
+    task->mapLevelsOfDetail = 0;
+    task->mapLevelsOfDetailMargin = 0.005;
+    task->collisionPairLevelsMap = 0;
     task->validStateSampling.type = TaskDef::ValidStateSampling::DEFAULT;
+    task->validStateSampling.batchSize = 100;
+    task->validStateSampling.samplerType = sim_ompl_validstatesamplertype_uniform;
+    task->validStateSampling.candidateBatchSize = 50;
+    task->validStateSampling.calls = 0;
+    task->validStateSampling.accepted = 0;
+    task->validStateSampling.nanoseconds = 0;
     task->projectionEvaluation.type = TaskDef::ProjectionEvaluation::DEFAULT;
+    task->projectionEvaluation.cellsPerDimension = 20;
     task->algorithm = sim_ompl_algorithm_KPIECE1;
+    task->portfolioWinner = -1;
+    task->roadmapThreadCount = 1;
+    task->roadmapMilestoneCount = 1000;
+    task->sampleBatchSize = 0;
+    task->sampleBatchThreadCount = 1;
+    task->sampleBatchPrefetch = false;
+    task->validSamplePoolDepth = 0;
+    task->validSamplePoolThreadCount = 1;
+    task->termination.iterations = 0;
+    task->termination.solutionCount = 0;
+    task->termination.costThreshold = 0.0;
+    task->termination.plateauWindow = 0.0;
+    task->termination.plateauTolerance = 0.0;
+    task->validityCheckCount = 0;
+    task->collisionCheckCount = 0;
+    task->lastPlanningTime = 0.0;
+    task->memoryBudget = 0;
     task->verboseLevel = 0;
     tasks[task->header.handle] = task;
     out->taskHandle = task->header.handle;
@@ -996,6 +4094,7 @@ void destroyTask(SScriptCallBack *p, const char *cmd, destroyTask_in *in, destro
 {
     TaskDef *task = getTask(in->taskHandle);
 
+    removeSceneObjects(task);
     tasks.erase(in->taskHandle);
     delete task;
 }
@@ -1035,6 +4134,14 @@ void printTaskInfo(SScriptCallBack *p, const char *cmd, printTaskInfo_in *in, pr
     for(size_t i = 0; i < task->collisionPairHandles.size(); i++)
         s << (i ? ", " : "") << task->collisionPairHandles[i];
     s << "}" << std::endl;
+    if(task->collisionPairAnalysisSamples > 0)
+        s << prefix << "collision pair analysis samples: " << task->collisionPairAnalysisSamples << std::endl;
+    if(task->workspaceCullingSamples > 0)
+        s << prefix << "workspace culling: margin " << task->workspaceCullingMargin << std::endl;
+    if(task->mapLevelsOfDetail > 0)
+        s << prefix << "map levels of detail: " << task->mapLevelsOfDetail << ", margin " << task->mapLevelsOfDetailMargin << std::endl;
+    if(task->collisionProxyHullCount > 0)
+        s << prefix << "collision proxies: " << task->collisionProxyHullCount << " convex hulls, margin " << task->collisionProxyMargin << (task->collisionProxyExactFallback ? ", exact fallback" : "") << std::endl;
     s << prefix << "start state: {";
     for(size_t i = 0; i < task->startState.size(); i++)
         s << (i ? ", " : "") << task->startState[i];
@@ -1070,6 +4177,12 @@ void printTaskInfo(SScriptCallBack *p, const char *cmd, printTaskInfo_in *in, pr
         s << prefix << "        scriptId: " << task->goal.callback.scriptId << std::endl;
         s << prefix << "        function: " << task->goal.callback.function << std::endl;
         break;
+    case TaskDef::Goal::NATIVE:
+        s << std::endl;
+        s << prefix << "    native function:" << std::endl;
+        s << prefix << "        library: " << task->goal.nativeCallback.library << std::endl;
+        s << prefix << "        function: " << task->goal.nativeCallback.function << std::endl;
+        break;
     default:
         s << " ???" << std::endl;
         break;
@@ -1086,16 +4199,33 @@ void printTaskInfo(SScriptCallBack *p, const char *cmd, printTaskInfo_in *in, pr
         s << prefix << "        scriptId: " << task->stateValidation.callback.scriptId << std::endl;
         s << prefix << "        function: " << task->stateValidation.callback.function << std::endl;
         break;
+    case TaskDef::StateValidation::BATCH_CLLBACK:
+        s << std::endl;
+        s << prefix << "    batch callback:" << std::endl;
+        s << prefix << "        scriptId: " << task->stateValidation.callback.scriptId << std::endl;
+        s << prefix << "        function: " << task->stateValidation.callback.function << std::endl;
+        break;
+    case TaskDef::StateValidation::NATIVE:
+        s << std::endl;
+        s << prefix << "    native function:" << std::endl;
+        s << prefix << "        library: " << task->stateValidation.nativeCallback.library << std::endl;
+        s << prefix << "        function: " << task->stateValidation.nativeCallback.function << std::endl;
+        break;
     default:
         s << " ???" << std::endl;
         break;
     }
     s << prefix << "state validity checking resolution: " << task->stateValidityCheckingResolution << std::endl;
+    s << prefix << "motion validation: " << motionvalidationtype_string(task->motionValidationType) << std::endl;
+    s << prefix << "collision pair ordering: " << collisionpairordering_string(task->collisionPairOrdering) << std::endl;
     s << prefix << "valid state sampling:";
     switch(task->validStateSampling.type)
     {
     case TaskDef::ValidStateSampling::DEFAULT:
-        s << " default" << std::endl;
+        s << " default (" << validstatesamplertype_string(task->validStateSampling.samplerType);
+        if(task->validStateSampling.samplerType == sim_ompl_validstatesamplertype_gaussian || task->validStateSampling.samplerType == sim_ompl_validstatesamplertype_bridge_test)
+            s << ", " << task->validStateSampling.candidateBatchSize << " candidates per block";
+        s << ")" << std::endl;
         break;
     case TaskDef::ValidStateSampling::CLLBACK:
         s << std::endl;
@@ -1106,6 +4236,25 @@ void printTaskInfo(SScriptCallBack *p, const char *cmd, printTaskInfo_in *in, pr
         s << prefix << "        scriptId: " << task->validStateSampling.callbackNear.scriptId << std::endl;
         s << prefix << "        function: " << task->validStateSampling.callbackNear.function << std::endl;
         break;
+    case TaskDef::ValidStateSampling::BATCH_CLLBACK:
+        s << std::endl;
+        s << prefix << "    batch callback:" << std::endl;
+        s << prefix << "        scriptId: " << task->validStateSampling.callback.scriptId << std::endl;
+        s << prefix << "        function: " << task->validStateSampling.callback.function << std::endl;
+        s << prefix << "        batch size: " << task->validStateSampling.batchSize << std::endl;
+        s << prefix << "    callbackNear:" << std::endl;
+        s << prefix << "        scriptId: " << task->validStateSampling.callbackNear.scriptId << std::endl;
+        s << prefix << "        function: " << task->validStateSampling.callbackNear.function << std::endl;
+        break;
+    case TaskDef::ValidStateSampling::NATIVE:
+        s << std::endl;
+        s << prefix << "    native function:" << std::endl;
+        s << prefix << "        library: " << task->validStateSampling.nativeCallback.library << std::endl;
+        s << prefix << "        function: " << task->validStateSampling.nativeCallback.function << std::endl;
+        s << prefix << "    native function near:" << std::endl;
+        s << prefix << "        library: " << task->validStateSampling.nativeCallbackNear.library << std::endl;
+        s << prefix << "        function: " << task->validStateSampling.nativeCallbackNear.function << std::endl;
+        break;
     }
     s << prefix << "projection evaluation:";
     switch(task->projectionEvaluation.type)
@@ -1123,7 +4272,44 @@ void printTaskInfo(SScriptCallBack *p, const char *cmd, printTaskInfo_in *in, pr
         s << " ???" << std::endl;
         break;
     }
+    s << prefix << "projection cell sizes: ";
+    if(task->projectionEvaluation.cellSizes.empty())
+    {
+        s << "auto (" << task->projectionEvaluation.cellsPerDimension << " cells per dimension)" << std::endl;
+    }
+    else
+    {
+        s << "{";
+        for(size_t i = 0; i < task->projectionEvaluation.cellSizes.size(); i++)
+            s << (i ? ", " : "") << task->projectionEvaluation.cellSizes[i];
+        s << "}" << std::endl;
+    }
     s << prefix << "algorithm: " << algorithm_string(task->algorithm) << std::endl;
+    if(task->termination.iterations > 0)
+        s << prefix << "termination: after " << task->termination.iterations << " iterations" << std::endl;
+    if(task->termination.solutionCount > 0)
+        s << prefix << "termination: after " << task->termination.solutionCount << " exact solutions" << std::endl;
+    if(task->termination.costThreshold > 0)
+        s << prefix << "termination: at cost " << task->termination.costThreshold << std::endl;
+    if(task->termination.plateauWindow > 0)
+        s << prefix << "termination: cost improved less than " << task->termination.plateauTolerance << " in " << task->termination.plateauWindow << "s" << std::endl;
+    if(task->validSamplePoolDepth > 0)
+        s << prefix << "valid sample pool: " << task->validSamplePoolDepth << " samples, " << task->validSamplePoolThreadCount << " threads" << std::endl;
+    if(task->sampleBatchSize > 0)
+        s << prefix << "sample batch validation: " << task->sampleBatchSize << " samples, " << task->sampleBatchThreadCount << " threads" << std::endl;
+    if(task->roadmapThreadCount > 1)
+        s << prefix << "roadmap construction: " << task->roadmapThreadCount << " threads, " << task->roadmapMilestoneCount << " milestones" << std::endl;
+    if(task->memoryBudget > 0)
+        s << prefix << "memory budget: " << task->memoryBudget << " bytes" << std::endl;
+    if(!task->portfolio.empty())
+    {
+        s << prefix << "portfolio: {";
+        for(size_t i = 0; i < task->portfolio.size(); i++)
+            s << (i ? ", " : "") << algorithm_string(task->portfolio[i]);
+        s << "}" << std::endl;
+    }
+    if(!task->traceFile.empty())
+        s << prefix << "trace file: " << task->traceFile << std::endl;
 
     simAddStatusbarMessage(s.str().c_str());
     std::cout << s.str();
@@ -1143,6 +4329,89 @@ void setStateValidityCheckingResolution(SScriptCallBack *p, const char *cmd, set
     task->stateValidityCheckingResolution = in->resolution;
 }
 
+void setTraceFile(SScriptCallBack *p, const char *cmd, setTraceFile_in *in, setTraceFile_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->traceFile = in->filename;
+}
+
+void setCollisionPairOrdering(SScriptCallBack *p, const char *cmd, setCollisionPairOrdering_in *in, setCollisionPairOrdering_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->collisionPairOrdering = static_cast<CollisionPairOrdering>(in->ordering);
+}
+
+void setCollisionPairAnalysis(SScriptCallBack *p, const char *cmd, setCollisionPairAnalysis_in *in, setCollisionPairAnalysis_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->samples < 0)
+        throw std::string("Number of samples must not be negative.");
+
+    task->collisionPairAnalysisSamples = in->samples;
+}
+
+void setWorkspaceCulling(SScriptCallBack *p, const char *cmd, setWorkspaceCulling_in *in, setWorkspaceCulling_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->samples < 0)
+        throw std::string("Number of samples must not be negative.");
+    if(in->margin < 0)
+        throw std::string("Margin must not be negative.");
+
+    task->workspaceCullingSamples = in->samples;
+    task->workspaceCullingMargin = in->margin;
+}
+
+void setCollisionProxies(SScriptCallBack *p, const char *cmd, setCollisionProxies_in *in, setCollisionProxies_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->hullCount < 0)
+        throw std::string("Number of convex hulls must not be negative.");
+    if(in->margin < 0)
+        throw std::string("Margin must not be negative.");
+
+    task->collisionProxyHullCount = in->hullCount;
+    task->collisionProxyMargin = in->margin;
+    task->collisionProxyExactFallback = in->exactFallback;
+}
+
+void setMapLevelsOfDetail(SScriptCallBack *p, const char *cmd, setMapLevelsOfDetail_in *in, setMapLevelsOfDetail_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->levels < 0)
+        throw std::string("Number of levels must not be negative.");
+    if(in->margin < 0)
+        throw std::string("Margin must not be negative.");
+
+    task->mapLevelsOfDetail = in->levels;
+    task->mapLevelsOfDetailMargin = in->margin;
+}
+
+void setValidStateSamplerType(SScriptCallBack *p, const char *cmd, setValidStateSamplerType_in *in, setValidStateSamplerType_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->candidateBatchSize < 1)
+        throw std::string("Candidate batch size must be at least 1.");
+
+    task->validStateSampling.type = TaskDef::ValidStateSampling::DEFAULT;
+    task->validStateSampling.samplerType = static_cast<ValidStateSamplerType>(in->type);
+    task->validStateSampling.candidateBatchSize = in->candidateBatchSize;
+}
+
+void setMotionValidationType(SScriptCallBack *p, const char *cmd, setMotionValidationType_in *in, setMotionValidationType_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->motionValidationType = static_cast<MotionValidationType>(in->type);
+}
+
 void setStateSpace(SScriptCallBack *p, const char *cmd, setStateSpace_in *in, setStateSpace_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
@@ -1193,11 +4462,93 @@ void setStateSpace(SScriptCallBack *p, const char *cmd, setStateSpace_in *in, se
     }
 }
 
-void setAlgorithm(SScriptCallBack *p, const char *cmd, setAlgorithm_in *in, setAlgorithm_out *out)
+void setAlgorithm(SScriptCallBack *p, const char *cmd, setAlgorithm_in *in, setAlgorithm_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->algorithm = static_cast<Algorithm>(in->algorithm);
+}
+
+void setPortfolio(SScriptCallBack *p, const char *cmd, setPortfolio_in *in, setPortfolio_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    // an empty table disables portfolio planning:
+    task->portfolio.clear();
+    for(size_t i = 0; i < in->algorithms.size(); i++)
+        task->portfolio.push_back(static_cast<Algorithm>(in->algorithms[i]));
+
+    // the planners of the previous portfolio are gone with it (setup()
+    // creates the new ones):
+    task->portfolioPlanners.clear();
+    task->portfolioWinner = -1;
+}
+
+void setRoadmapConstruction(SScriptCallBack *p, const char *cmd, setRoadmapConstruction_in *in, setRoadmapConstruction_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->threadCount < 1)
+        throw std::string("Number of threads must be at least 1.");
+    if(in->milestoneCount < 0)
+        throw std::string("Number of milestones must not be negative.");
+
+    task->roadmapThreadCount = in->threadCount;
+    task->roadmapMilestoneCount = in->milestoneCount;
+}
+
+void setSampleBatchValidation(SScriptCallBack *p, const char *cmd, setSampleBatchValidation_in *in, setSampleBatchValidation_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->batchSize < 0)
+        throw std::string("Batch size must not be negative.");
+    if(in->threadCount < 1)
+        throw std::string("Number of threads must be at least 1.");
+
+    task->sampleBatchSize = in->batchSize;
+    task->sampleBatchThreadCount = in->threadCount;
+}
+
+void setValidSamplePool(SScriptCallBack *p, const char *cmd, setValidSamplePool_in *in, setValidSamplePool_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->depth < 0)
+        throw std::string("Pool depth must not be negative.");
+    if(in->threadCount < 1)
+        throw std::string("Number of threads must be at least 1.");
+
+    task->validSamplePoolDepth = in->depth;
+    task->validSamplePoolThreadCount = in->threadCount;
+}
+
+void setTermination(SScriptCallBack *p, const char *cmd, setTermination_in *in, setTermination_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
 
-    task->algorithm = static_cast<Algorithm>(in->algorithm);
+    if(in->plateauWindow > 0 && in->plateauTolerance < 0)
+        throw std::string("Plateau tolerance must not be negative.");
+
+    task->termination.iterations = in->iterations;
+    task->termination.solutionCount = in->solutionCount;
+    task->termination.costThreshold = in->costThreshold;
+    task->termination.plateauWindow = in->plateauWindow;
+    task->termination.plateauTolerance = in->plateauTolerance;
+}
+
+void getTerminationReason(SScriptCallBack *p, const char *cmd, getTerminationReason_in *in, getTerminationReason_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    out->reason = task->termination.reason;
+}
+
+void getPortfolioWinner(SScriptCallBack *p, const char *cmd, getPortfolioWinner_in *in, getPortfolioWinner_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    out->algorithm = task->portfolioWinner >= 0 ? task->portfolio[task->portfolioWinner] : -1;
 }
 
 void setCollisionPairs(SScriptCallBack *p, const char *cmd, setCollisionPairs_in *in, setCollisionPairs_out *out)
@@ -1208,6 +4559,13 @@ void setCollisionPairs(SScriptCallBack *p, const char *cmd, setCollisionPairs_in
     task->collisionPairHandles.clear();
     for(int i = 0; i < numHandles; i++)
         task->collisionPairHandles.push_back(in->collisionPairHandles[i]);
+
+    task->collisionPairCheckHandles = task->collisionPairHandles;
+    task->collisionPairExactHandles = task->collisionPairHandles;
+    task->collisionPairLevelShapes.assign(numHandles / 2, -1);
+    task->shapeBoxes.clear();
+    task->collisionPairIgnored.clear();
+    resetCollisionPairOrder(task);
 }
 
 void validateStateSize(const TaskDef *task, const std::vector<float>& s, std::string descr = "State")
@@ -1291,6 +4649,143 @@ void setGoal(SScriptCallBack *p, const char *cmd, setGoal_in *in, setGoal_out *o
     task->goal.refDummy = in->refDummy;
 }
 
+// PRM (or PRMstar) whose roadmap is first grown by several threads, until
+// it has a given number of milestones, before PRM::solve takes over. Each
+// thread samples valid milestones with its own sampler; adding a milestone
+// locks the graph only to insert it and to look up its neighbours, and again
+// to add the edges that passed checkMotion, which runs unlocked (unlike in
+// PRM::addMilestone). Validity checks that go through the scene are still
+// serialized by the scene lock, so this scales with native state validation.
+class ParallelPRM : public og::PRM
+{
+public:
+    ParallelPRM(const ob::SpaceInformationPtr &si, bool starStrategy, unsigned int threadCount, unsigned int milestoneCount)
+        : og::PRM(si, starStrategy), threadCount(threadCount), targetMilestoneCount(milestoneCount)
+    {
+        if(starStrategy)
+            setName("PRMstar");
+    }
+
+    virtual ob::PlannerStatus solve(const ob::PlannerTerminationCondition &ptc)
+    {
+        if(!isSetup())
+            setup();
+        if(milestoneCount() < targetMilestoneCount)
+            constructRoadmap(ptc);
+        return og::PRM::solve(ptc);
+    }
+
+protected:
+    void constructRoadmap(const ob::PlannerTerminationCondition &ptc)
+    {
+        std::atomic<long> remaining((long)targetMilestoneCount - (long)milestoneCount());
+        // the first exception thrown by a thread (e.g. by a callback), which
+        // stops the others and is rethrown once they have returned:
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> threads;
+        for(unsigned int t = 0; t < threadCount; t++)
+        {
+            threads.push_back(std::thread([&] {
+                trace::Scope scope("constructRoadmap");
+                try
+                {
+                    ob::ValidStateSamplerPtr sampler = si_->allocValidStateSampler();
+                    std::vector<Vertex> neighbors;
+                    std::vector<ob::State *> neighborStates;
+                    std::vector<bool> valid;
+                    while(!ptc && !failed && remaining-- > 0)
+                    {
+                        ob::State *state = si_->allocState();
+                        bool sampled;
+                        try
+                        {
+                            sampled = sampler->sample(state);
+                        }
+                        catch(...)
+                        {
+                            si_->freeState(state);
+                            throw;
+                        }
+                        if(!sampled)
+                        {
+                            si_->freeState(state);
+                            remaining++;
+                            continue;
+                        }
+                        addMilestoneUnlocked(state, neighbors, neighborStates, valid);
+                    }
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if(!error)
+                        error = std::current_exception();
+                    failed = true;
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    // like PRM::addMilestone, but checking motions without the graph lock;
+    // the vectors are per-thread buffers:
+    void addMilestoneUnlocked(ob::State *state, std::vector<Vertex> &neighbors, std::vector<ob::State *> &neighborStates, std::vector<bool> &valid)
+    {
+        Vertex m;
+        {
+            std::lock_guard<decltype(graphMutex_)> lock(graphMutex_);
+            m = boost::add_vertex(g_);
+            stateProperty_[m] = state;
+            totalConnectionAttemptsProperty_[m] = 1;
+            successfulConnectionAttemptsProperty_[m] = 0;
+            disjointSets_.make_set(m);
+
+            neighbors.clear();
+            neighborStates.clear();
+            const std::vector<Vertex> &candidates = connectionStrategy_(m);
+            for(size_t i = 0; i < candidates.size(); i++)
+            {
+                if(connectionFilter_(candidates[i], m))
+                {
+                    neighbors.push_back(candidates[i]);
+                    // the state pointers are stable, the property storage isn't:
+                    neighborStates.push_back(stateProperty_[candidates[i]]);
+                }
+            }
+        }
+
+        valid.assign(neighbors.size(), false);
+        for(size_t i = 0; i < neighbors.size(); i++)
+            valid[i] = si_->checkMotion(neighborStates[i], state);
+
+        std::lock_guard<decltype(graphMutex_)> lock(graphMutex_);
+        for(size_t i = 0; i < neighbors.size(); i++)
+        {
+            Vertex n = neighbors[i];
+            totalConnectionAttemptsProperty_[m]++;
+            totalConnectionAttemptsProperty_[n]++;
+            if(valid[i])
+            {
+                successfulConnectionAttemptsProperty_[m]++;
+                successfulConnectionAttemptsProperty_[n]++;
+                const ob::Cost weight = opt_->motionCost(neighborStates[i], state);
+                const Graph::edge_property_type properties(weight);
+                boost::add_edge(n, m, properties, g_);
+                uniteComponents(n, m);
+            }
+        }
+        nn_->add(m);
+    }
+
+    unsigned int threadCount;
+    unsigned int targetMilestoneCount;
+};
+
 ob::PlannerPtr plannerFactory(Algorithm algorithm, ob::SpaceInformationPtr si)
 {
     ob::PlannerPtr planner;
@@ -1328,86 +4823,701 @@ ob::PlannerPtr plannerFactory(Algorithm algorithm, ob::SpaceInformationPtr si)
     return planner;
 }
 
+// installs the validity checker, motion validator and sampler of the task
+// into a space information object:
+void configureSpaceInformation(TaskDef *task, const ob::SpaceInformationPtr &si)
+{
+    si->setStateValidityChecker(ob::StateValidityCheckerPtr(new StateValidityChecker(si, task)));
+    si->setStateValidityCheckingResolution(task->stateValidityCheckingResolution);
+    si->setValidStateSamplerAllocator(std::bind(allocValidStateSampler, std::placeholders::_1, task));
+    if(task->motionValidationType == sim_ompl_motionvalidationtype_conservative_advancement)
+    {
+        if(task->stateValidation.type != TaskDef::StateValidation::DEFAULT)
+            throw std::string("Conservative advancement motion validation requires the default state validation.");
+        si->setMotionValidator(ob::MotionValidatorPtr(new MotionValidator(si, task)));
+    }
+    else if(task->stateValidation.type == TaskDef::StateValidation::BATCH_CLLBACK)
+    {
+        si->setMotionValidator(ob::MotionValidatorPtr(new BatchMotionValidator(si, task)));
+    }
+}
+
 void setup(SScriptCallBack *p, const char *cmd, setup_in *in, setup_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
 
     task->stateSpacePtr = ob::StateSpacePtr(new StateSpace(task));
+    classifyCollisionPairs(task);
+    cullWorkspace(task);
+    useCollisionProxies(task);
+    useMapLevelsOfDetail(task);
+    cacheShapeBoxes(task);
+    task->robotDummyChain.reset();
+    if(task->goal.type == TaskDef::Goal::DUMMY_PAIR)
+    {
+        task->robotDummyChain = std::shared_ptr<KinematicChain>(new KinematicChain(task, task->goal.dummyPair.robotDummy, task->goal.refDummy));
+        if(!task->robotDummyChain->isValid() && task->verboseLevel >= 1)
+            simAddStatusbarMessage("OMPL: robot dummy pose can't be computed from the state alone, goal checks will use the scene.");
+    }
     task->spaceInformationPtr = ob::SpaceInformationPtr(new ob::SpaceInformation(task->stateSpacePtr));
     task->projectionEvaluatorPtr = ob::ProjectionEvaluatorPtr(new ProjectionEvaluator(task->stateSpacePtr, task));
+    if(!task->projectionEvaluation.cellSizes.empty() && task->projectionEvaluation.cellSizes.size() != task->projectionEvaluatorPtr->getDimension())
+        throw std::string("Projection cell sizes must have the same length as the projection.");
     task->stateSpacePtr->registerDefaultProjection(task->projectionEvaluatorPtr);
     task->problemDefinitionPtr = ob::ProblemDefinitionPtr(new ob::ProblemDefinition(task->spaceInformationPtr));
-    task->spaceInformationPtr->setStateValidityChecker(ob::StateValidityCheckerPtr(new StateValidityChecker(task->spaceInformationPtr, task)));
-    task->spaceInformationPtr->setStateValidityCheckingResolution(task->stateValidityCheckingResolution);
-    task->spaceInformationPtr->setValidStateSamplerAllocator(std::bind(allocValidStateSampler, std::placeholders::_1, task));
+    configureSpaceInformation(task, task->spaceInformationPtr);
+
+    ob::ScopedState<> startState(task->stateSpacePtr);
+    validateStateSize(task, task->startState, "Start state");
+    for(size_t i = 0; i < task->startState.size(); i++)
+        startState[i] = task->startState[i];
+    task->problemDefinitionPtr->addStartState(startState);
+
+    ob::GoalPtr goal;
+    if(task->goal.type == TaskDef::Goal::STATE)
+    {
+        for(size_t i = 0; i < task->goal.states.size(); i++)
+            validateStateSize(task, task->goal.states[i], "Goal state");
+
+        if(task->goal.states.size() > 1)
+        {
+            goal = ob::GoalPtr(new ob::GoalStates(task->spaceInformationPtr));
+            for(size_t j = 0; j < task->goal.states.size(); j++)
+            {
+                ob::ScopedState<> goalState(task->stateSpacePtr);
+                for(size_t i = 0; i < task->goal.states[j].size(); i++)
+                    goalState[i] = task->goal.states[j][i];
+                goal->as<ob::GoalStates>()->addState(goalState);
+            }
+        }
+        else if(task->goal.states.size() == 1)
+        {
+            goal = ob::GoalPtr(new ob::GoalState(task->spaceInformationPtr));
+            ob::ScopedState<> goalState(task->stateSpacePtr);
+            for(size_t i = 0; i < task->goal.states[0].size(); i++)
+                goalState[i] = task->goal.states[0][i];
+            goal->as<ob::GoalState>()->setState(goalState);
+        }
+        else
+        {
+            throw std::string("No goal state specified.");
+        }
+    }
+    else if(task->goal.type == TaskDef::Goal::DUMMY_PAIR || task->goal.type == TaskDef::Goal::CLLBACK || task->goal.type == TaskDef::Goal::NATIVE)
+    {
+        goal = ob::GoalPtr(new Goal(task->spaceInformationPtr, task, (double)task->goal.tolerance));
+    }
+    task->problemDefinitionPtr->setGoal(goal);
+
+    task->validSamplePool.reset();
+    if(task->validSamplePoolDepth > 0 && task->validStateSampling.type == TaskDef::ValidStateSampling::DEFAULT)
+    {
+        task->validSamplePool = std::make_shared<ValidSamplePool>(task->spaceInformationPtr, task->validSamplePoolDepth, task->validSamplePoolThreadCount);
+        if(task->stateValidation.type != TaskDef::StateValidation::NATIVE && task->verboseLevel >= 1)
+            simAddStatusbarMessage("OMPL: the valid sample pool's threads validate states under the scene lock; they only run in parallel with native state validation.");
+    }
+
+    task->portfolioPlanners.clear();
+    task->portfolioWinner = -1;
+    if(!task->portfolio.empty())
+    {
+        // each planner of the portfolio gets its own space information, hence
+        // its own validity checker and motion validator:
+        for(size_t i = 0; i < task->portfolio.size(); i++)
+        {
+            ob::SpaceInformationPtr si(new ob::SpaceInformation(task->stateSpacePtr));
+            configureSpaceInformation(task, si);
+            ob::PlannerPtr planner = plannerFactory(task->portfolio[i], si);
+            if(!planner)
+                throw std::string("Invalid motion planning algorithm in portfolio.");
+            planner->setProblemDefinition(task->problemDefinitionPtr);
+            task->portfolioPlanners.push_back(planner);
+        }
+        task->planner = task->portfolioPlanners[0];
+        return;
+    }
+
+    if(task->roadmapThreadCount > 1 && (task->algorithm == sim_ompl_algorithm_PRM || task->algorithm == sim_ompl_algorithm_PRMstar))
+        task->planner = ob::PlannerPtr(new ParallelPRM(task->spaceInformationPtr, task->algorithm == sim_ompl_algorithm_PRMstar, task->roadmapThreadCount, task->roadmapMilestoneCount));
+    else
+        task->planner = plannerFactory(task->algorithm, task->spaceInformationPtr);
+    if(!task->planner)
+    {
+        throw std::string("Invalid motion planning algorithm.");
+    }
+    task->planner->setProblemDefinition(task->problemDefinitionPtr);
+}
+
+// state shared by the termination conditions of the planners of one solve()
+// call (see terminationCondition):
+struct TerminationState
+{
+    std::chrono::steady_clock::time_point startTime;
+    std::atomic<bool> fired;
+    std::mutex mutex;
+    double lastPoll;
+    // best cost over time, for plateau detection:
+    std::deque<std::pair<double, double> > costs;
+};
+
+std::shared_ptr<TerminationState> startTermination(TaskDef *task)
+{
+    std::shared_ptr<TerminationState> state = std::make_shared<TerminationState>();
+    state->startTime = std::chrono::steady_clock::now();
+    state->fired = false;
+    state->lastPoll = -1.0;
+    task->termination.reason = "";
+    return state;
+}
+
+// the termination condition of one planner of a solve() call: maxTime or any
+// of the task's termination conditions, whichever comes first. The condition
+// that fired is stored in task->termination.reason, and then ends all the
+// planners sharing the state. The iteration limit counts the evaluations of
+// this condition only, so that each planner of a portfolio has its own
+// count. Planners may evaluate the condition from several threads; the
+// solutions are only looked at every 10 ms.
+ob::PlannerTerminationCondition terminationCondition(TaskDef *task, double maxTime, const std::shared_ptr<TerminationState> &state)
+{
+    std::shared_ptr<std::atomic<long> > evaluations = std::make_shared<std::atomic<long> >(0);
+
+    return ob::PlannerTerminationCondition([task, maxTime, state, evaluations]() -> bool {
+        if(state->fired)
+            return true;
+
+        const TaskDef::Termination &t = task->termination;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->startTime).count();
+        const char *reason = nullptr;
+        if(elapsed >= maxTime)
+            reason = "time";
+        else if(t.iterations > 0 && ++*evaluations >= t.iterations)
+            reason = "iterations";
+
+        std::unique_lock<std::mutex> lock(state->mutex, std::defer_lock);
+        if(!reason && (t.solutionCount > 0 || t.costThreshold > 0 || t.plateauWindow > 0))
+            lock.lock();
+        if(lock.owns_lock() && elapsed - state->lastPoll >= 0.01)
+        {
+            state->lastPoll = elapsed;
+            const ob::ProblemDefinitionPtr &pdef = task->problemDefinitionPtr;
+            std::vector<ob::PlannerSolution> solutions = pdef->getSolutions();
+            int exact = 0;
+            for(size_t i = 0; i < solutions.size(); i++)
+                if(!solutions[i].approximate_)
+                    exact++;
+            if(t.solutionCount > 0 && exact >= t.solutionCount)
+            {
+                reason = "solutions";
+            }
+            else if(exact > 0)
+            {
+                // solutions are sorted, best first:
+                const ob::PathPtr &path = solutions[0].path_;
+                double cost = pdef->hasOptimizationObjective() ? path->cost(pdef->getOptimizationObjective()).value() : path->length();
+                if(t.costThreshold > 0 && cost <= t.costThreshold)
+                {
+                    reason = "cost";
+                }
+                else if(t.plateauWindow > 0)
+                {
+                    state->costs.push_back(std::make_pair(elapsed, cost));
+                    while(state->costs.size() > 1 && state->costs[1].first <= elapsed - t.plateauWindow)
+                        state->costs.pop_front();
+                    const std::pair<double, double> &oldest = state->costs.front();
+                    if(oldest.first <= elapsed - t.plateauWindow && oldest.second - cost <= t.plateauTolerance * oldest.second)
+                        reason = "plateau";
+                }
+            }
+        }
+
+        if(!reason)
+            return false;
+        if(!lock.owns_lock())
+            lock.lock();
+        if(!state->fired)
+            task->termination.reason = reason;
+        state->fired = true;
+        return true;
+    });
+}
+
+// runs all the planners of the portfolio in parallel on the task's problem
+// definition; the first one to find an exact solution stops the others.
+// Each planner has its own validity checker, but checks that go through the
+// scene or Lua are serialized by sceneMutex: unless the state validation is
+// native, the planners take turns on one CPU rather than running in parallel.
+ob::PlannerStatus solvePortfolio(TaskDef *task, double maxTime, const std::shared_ptr<TerminationState> &termination)
+{
+    std::atomic<int> winner(-1);
+    // the first exception thrown by a planner (e.g. by a callback), which
+    // stops the others and is rethrown once they have returned:
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    std::atomic<bool> failed(false);
+    ob::PlannerTerminationCondition won([&winner, &failed] { return winner >= 0 || failed; });
+
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < task->portfolioPlanners.size(); i++)
+    {
+        ob::PlannerPtr planner = task->portfolioPlanners[i];
+        const char *name = algorithm_string(task->portfolio[i]);
+        ob::PlannerTerminationCondition ptc = ob::plannerOrTerminationCondition(terminationCondition(task, maxTime, termination), won);
+        threads.push_back(std::thread([planner, i, name, ptc, &winner, &error, &errorMutex, &failed] {
+            trace::Scope scope(name);
+            try
+            {
+                ob::PlannerStatus status = planner->solve(ptc);
+                int none = -1;
+                if(status == ob::PlannerStatus::EXACT_SOLUTION)
+                    winner.compare_exchange_strong(none, (int)i);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error)
+                    error = std::current_exception();
+                failed = true;
+            }
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    if(error)
+    {
+        task->portfolioWinner = -1;
+        std::rethrow_exception(error);
+    }
+
+    task->portfolioWinner = winner;
+    if(winner >= 0)
+    {
+        task->planner = task->portfolioPlanners[winner];
+        return ob::PlannerStatus::EXACT_SOLUTION;
+    }
+    if(task->problemDefinitionPtr->hasSolution())
+        return ob::PlannerStatus::APPROXIMATE_SOLUTION;
+    return ob::PlannerStatus::TIMEOUT;
+}
+
+// collision counts per pair of previous solve() calls, for seeding the
+// adaptive collision pair ordering; keyed by the map's content hash and by
+// the collision pairs (with the map shape's handle replaced by -2, as it
+// changes each time the map is loaded):
+std::map<std::pair<uint64_t, std::vector<simInt> >, std::vector<unsigned long> > collisionPairHitHistory;
+
+std::pair<uint64_t, std::vector<simInt> > collisionPairHistoryKey(const TaskDef *task)
+{
+    std::vector<simInt> pairs = task->collisionPairHandles;
+    if(mapcache::currentShape != -1)
+        std::replace(pairs.begin(), pairs.end(), mapcache::currentShape, -2);
+    return std::make_pair(mapcache::currentHash, pairs);
+}
+
+// resets the collision pair order for a new solve() call: the given order,
+// or (if seeded) the pairs sorted by their past collision counts:
+void beginCollisionPairOrdering(TaskDef *task)
+{
+    size_t n = task->collisionPairHandles.size() / 2;
+    resetCollisionPairOrder(task);
+
+    if(task->collisionPairOrdering != sim_ompl_collisionpairordering_adaptive_seeded)
+        return;
+
+    std::map<std::pair<uint64_t, std::vector<simInt> >, std::vector<unsigned long> >::const_iterator it = collisionPairHitHistory.find(collisionPairHistoryKey(task));
+    if(it == collisionPairHitHistory.end() || it->second.size() != n)
+        return;
+    task->collisionPairHits = it->second;
+    const std::vector<unsigned long> &hits = task->collisionPairHits;
+    std::stable_sort(task->collisionPairOrder.begin(), task->collisionPairOrder.end(), [&hits](size_t a, size_t b) { return hits[a] > hits[b]; });
+}
+
+void endCollisionPairOrdering(TaskDef *task)
+{
+    if(task->collisionPairOrdering == sim_ompl_collisionpairordering_adaptive_seeded)
+        collisionPairHitHistory[collisionPairHistoryKey(task)] = task->collisionPairHits;
+}
+
+// estimated heap memory of one state of the given space (allocation
+// overhead included):
+size_t stateMemory(const ob::StateSpace *space)
+{
+    const size_t overhead = 16; // per allocation
+    if(space->isCompound())
+    {
+        const ob::CompoundStateSpace *c = space->as<ob::CompoundStateSpace>();
+        size_t m = sizeof(ob::CompoundState) + overhead + c->getSubspaceCount() * sizeof(ob::State *) + overhead;
+        for(unsigned int i = 0; i < c->getSubspaceCount(); i++)
+            m += stateMemory(c->getSubspace(i).get());
+        return m;
+    }
+    if(const ob::RealVectorStateSpace *r = dynamic_cast<const ob::RealVectorStateSpace *>(space))
+        return sizeof(ob::RealVectorStateSpace::StateType) + overhead + r->getDimension() * sizeof(double) + overhead;
+    return space->getSerializationLength() + sizeof(void *) + overhead;
+}
+
+struct MemoryUsage
+{
+    unsigned int vertexCount;
+    unsigned int edgeCount;
+    unsigned int pathStateCount;
+    long bytes;
+};
+
+// estimates the memory held by the task's planners (roadmap or tree states,
+// their edges and nearest neighbor structures) and its solution path:
+MemoryUsage estimateMemoryUsage(TaskDef *task)
+{
+    // rough per vertex / per edge cost of OMPL's graphs and NN structures:
+    const size_t vertexOverhead = 96, edgeOverhead = 48;
+
+    MemoryUsage usage = {0, 0, 0, 0};
+    if(!task->spaceInformationPtr)
+        return usage;
+    size_t perState = stateMemory(task->stateSpacePtr.get());
+
+    std::vector<ob::PlannerPtr> planners = task->portfolioPlanners;
+    if(planners.empty() && task->planner)
+        planners.push_back(task->planner);
+    for(size_t i = 0; i < planners.size(); i++)
+    {
+        ob::PlannerData data(planners[i]->getSpaceInformation());
+        planners[i]->getPlannerData(data);
+        usage.vertexCount += data.numVertices();
+        usage.edgeCount += data.numEdges();
+    }
+
+    if(task->problemDefinitionPtr && task->problemDefinitionPtr->hasSolution())
+    {
+        og::PathGeometric *path = dynamic_cast<og::PathGeometric *>(task->problemDefinitionPtr->getSolutionPath().get());
+        if(path)
+            usage.pathStateCount = path->getStateCount();
+    }
+
+    usage.bytes = usage.vertexCount * (perState + vertexOverhead) + usage.edgeCount * edgeOverhead + usage.pathStateCount * perState;
+    return usage;
+}
+
+// clears the planner data (keeping the solution path) if the task is over
+// its memory budget:
+void enforceMemoryBudget(TaskDef *task)
+{
+    if(task->memoryBudget <= 0) return;
+
+    MemoryUsage usage = estimateMemoryUsage(task);
+    if(usage.bytes <= task->memoryBudget) return;
+
+    if(task->planner)
+        task->planner->clear();
+    for(size_t i = 0; i < task->portfolioPlanners.size(); i++)
+        task->portfolioPlanners[i]->clear();
+
+    if(task->verboseLevel >= 1)
+    {
+        std::stringstream s;
+        s << "OMPL: planner data (" << usage.vertexCount << " states, about " << usage.bytes << " bytes) exceeded the memory budget and was cleared.";
+        simAddStatusbarMessage(s.str().c_str());
+    }
+}
+
+void getMemoryUsage(SScriptCallBack *p, const char *cmd, getMemoryUsage_in *in, getMemoryUsage_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    MemoryUsage usage = estimateMemoryUsage(task);
+    out->vertexCount = usage.vertexCount;
+    out->edgeCount = usage.edgeCount;
+    out->pathStateCount = usage.pathStateCount;
+    out->bytes = usage.bytes;
+}
+
+void setMemoryBudget(SScriptCallBack *p, const char *cmd, setMemoryBudget_in *in, setMemoryBudget_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->bytes < 0)
+        throw std::string("Memory budget must not be negative.");
+
+    task->memoryBudget = in->bytes;
+    enforceMemoryBudget(task);
+}
+
+static int callback(void *NotUsed, int argc, char **argv, char **azColName) {
+   int i;
+   for(i = 0; i<argc; i++) {
+      printf("%s = %s\n", azColName[i], argv[i] ? argv[i] : "NULL");
+   }
+   printf("\n");
+   return 0;
+}
+
+// hardware performance counters (cycles, instructions, cache misses, branch
+// misses) of the thread calling solve() and of the threads it starts, in user
+// space only. Enabled by setting the SIM_OMPL_PERF_COUNTERS environment
+// variable; if the kernel refuses perf_event_open (e.g. perf_event_paranoid
+// is too high), the counters are simply not available.
+class PerfCounters
+{
+public:
+    enum {CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNT};
+
+    PerfCounters()
+    {
+        for(int i = 0; i < COUNT; i++)
+        {
+            fd[i] = -1;
+            values[i] = 0;
+        }
+        if(!std::getenv("SIM_OMPL_PERF_COUNTERS"))
+            return;
+
+        static const uint64_t configs[COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for(int i = 0; i < COUNT; i++)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1; // count the planner threads too
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if(fd[i] < 0)
+            {
+                close();
+                return;
+            }
+        }
+    }
+
+    ~PerfCounters()
+    {
+        close();
+    }
+
+    bool available() const
+    {
+        return fd[0] >= 0;
+    }
+
+    void start()
+    {
+        for(int i = 0; i < COUNT && available(); i++)
+        {
+            ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // stops counting; the threads started meanwhile must have exited:
+    void stop()
+    {
+        for(int i = 0; i < COUNT && available(); i++)
+        {
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+            // value, time enabled, time running (scaled up if the counter
+            // was multiplexed with others):
+            uint64_t data[3];
+            if(read(fd[i], data, sizeof(data)) != sizeof(data))
+            {
+                close();
+                return;
+            }
+            values[i] = data[2] ? (uint64_t)((double)data[0] * data[1] / data[2]) : 0;
+        }
+    }
+
+    uint64_t value(int i) const
+    {
+        return values[i];
+    }
+
+private:
+    void close()
+    {
+        for(int i = 0; i < COUNT; i++)
+        {
+            if(fd[i] >= 0)
+                ::close(fd[i]);
+            fd[i] = -1;
+        }
+    }
+
+    int fd[COUNT];
+    uint64_t values[COUNT];
+};
+
+// solve_stats table of the database named by the SIM_OMPL_SOLVE_STATS
+// environment variable, which the benchmark harness (Python_Program/
+// benchmark.py) reads. Recording is off if the variable is not set. The
+// database is opened and its schema migrated once, at the first solve().
+namespace solvestats
+{
+    std::mutex mutex;
+    bool opened = false;
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *insert = nullptr;
 
-    ob::ScopedState<> startState(task->stateSpacePtr);
-    validateStateSize(task, task->startState, "Start state");
-    for(size_t i = 0; i < task->startState.size(); i++)
-        startState[i] = task->startState[i];
-    task->problemDefinitionPtr->addStartState(startState);
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sqlite3_finalize(insert);
+        insert = nullptr;
+        sqlite3_close(db);
+        db = nullptr;
+        opened = false;
+    }
 
-    ob::GoalPtr goal;
-    if(task->goal.type == TaskDef::Goal::STATE)
+    // returns the insert statement, or nullptr if not recording (call with
+    // mutex locked):
+    sqlite3_stmt * open()
     {
-        for(size_t i = 0; i < task->goal.states.size(); i++)
-            validateStateSize(task, task->goal.states[i], "Goal state");
+        if(opened)
+            return insert;
+        opened = true;
 
-        if(task->goal.states.size() > 1)
+        const char *path = std::getenv("SIM_OMPL_SOLVE_STATS");
+        if(!path || !*path)
+            return nullptr;
+
+        if(sqlite3_open(path, &db) != SQLITE_OK)
         {
-            goal = ob::GoalPtr(new ob::GoalStates(task->spaceInformationPtr));
-            for(size_t j = 0; j < task->goal.states.size(); j++)
-            {
-                ob::ScopedState<> goalState(task->stateSpacePtr);
-                for(size_t i = 0; i < task->goal.states[j].size(); i++)
-                    goalState[i] = task->goal.states[j][i];
-                goal->as<ob::GoalStates>()->addState(goalState);
-            }
+            simAddStatusbarMessage((std::string("OMPL: cannot open solve stats database ") + path + ", not recording.").c_str());
+            sqlite3_close(db);
+            db = nullptr;
+            return nullptr;
         }
-        else if(task->goal.states.size() == 1)
+
+        sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS solve_stats (solve_id INTEGER PRIMARY KEY AUTOINCREMENT, task_name TEXT, algorithm_name TEXT, seed INTEGER, solved INTEGER, planning_time DOUBLE, validity_checks INTEGER, collision_checks INTEGER)", nullptr, nullptr, nullptr);
+        // tables created by older versions lack some columns:
+        static const char *columns[][2] = {
+            {"cycles", "INTEGER"}, {"instructions", "INTEGER"}, {"cache_misses", "INTEGER"}, {"branch_misses", "INTEGER"},
+            {"sample_pool_hits", "INTEGER"}, {"sample_pool_misses", "INTEGER"}, {"sample_pool_checks", "INTEGER"},
+            {"sampler_type", "TEXT"}, {"sampler_calls", "INTEGER"}, {"sampler_accepted", "INTEGER"}, {"sampler_time", "DOUBLE"},
+            {"termination_reason", "TEXT"}
+        };
+        std::vector<std::string> existing;
+        sqlite3_stmt *info = nullptr;
+        if(sqlite3_prepare_v2(db, "PRAGMA table_info(solve_stats)", -1, &info, nullptr) == SQLITE_OK)
         {
-            goal = ob::GoalPtr(new ob::GoalState(task->spaceInformationPtr));
-            ob::ScopedState<> goalState(task->stateSpacePtr);
-            for(size_t i = 0; i < task->goal.states[0].size(); i++)
-                goalState[i] = task->goal.states[0][i];
-            goal->as<ob::GoalState>()->setState(goalState);
+            while(sqlite3_step(info) == SQLITE_ROW)
+                if(const unsigned char *name = sqlite3_column_text(info, 1))
+                    existing.push_back((const char *)name);
         }
-        else
+        sqlite3_finalize(info);
+        for(size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
         {
-            throw std::string("No goal state specified.");
+            if(std::find(existing.begin(), existing.end(), columns[i][0]) == existing.end())
+                sqlite3_exec(db, (std::string("ALTER TABLE solve_stats ADD COLUMN ") + columns[i][0] + " " + columns[i][1]).c_str(), nullptr, nullptr, nullptr);
+        }
+
+        if(sqlite3_prepare_v2(db, "INSERT INTO solve_stats (task_name, algorithm_name, seed, solved, planning_time, validity_checks, collision_checks, cycles, instructions, cache_misses, branch_misses, sample_pool_hits, sample_pool_misses, sampler_type, sampler_calls, sampler_accepted, sampler_time, termination_reason, sample_pool_checks) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", -1, &insert, nullptr) != SQLITE_OK)
+        {
+            simAddStatusbarMessage((std::string("OMPL: cannot record solve stats in ") + path + ": " + sqlite3_errmsg(db)).c_str());
+            sqlite3_finalize(insert);
+            insert = nullptr;
         }
+        return insert;
     }
-    else if(task->goal.type == TaskDef::Goal::DUMMY_PAIR || task->goal.type == TaskDef::Goal::CLLBACK)
+}
+
+// appends one row for the last solve() call to solve_stats (if recording):
+void recordSolveStats(TaskDef *task, bool solved, double planningTime, const PerfCounters &counters)
+{
+    std::lock_guard<std::mutex> lock(solvestats::mutex);
+    sqlite3_stmt *stmt = solvestats::open();
+    if(!stmt)
+        return;
+
+    Algorithm algorithm = task->portfolioWinner >= 0 ? task->portfolio[task->portfolioWinner] : task->algorithm;
+    sqlite3_bind_text(stmt, 1, task->header.name.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, algorithm_string(algorithm), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 3, ompl::RNG::getSeed());
+    sqlite3_bind_int(stmt, 4, solved ? 1 : 0);
+    sqlite3_bind_double(stmt, 5, planningTime);
+    sqlite3_bind_int64(stmt, 6, task->validityCheckCount);
+    sqlite3_bind_int64(stmt, 7, task->collisionCheckCount);
+    for(int i = 0; i < PerfCounters::COUNT; i++)
     {
-        goal = ob::GoalPtr(new Goal(task->spaceInformationPtr, task, (double)task->goal.tolerance));
+        if(counters.available())
+            sqlite3_bind_int64(stmt, 8 + i, counters.value(i));
+        else
+            sqlite3_bind_null(stmt, 8 + i);
     }
-    task->problemDefinitionPtr->setGoal(goal);
-
-    task->planner = plannerFactory(task->algorithm, task->spaceInformationPtr);
-    if(!task->planner)
+    if(task->validSamplePool)
     {
-        throw std::string("Invalid motion planning algorithm.");
+        sqlite3_bind_int64(stmt, 8 + PerfCounters::COUNT, task->validSamplePool->hitCount());
+        sqlite3_bind_int64(stmt, 9 + PerfCounters::COUNT, task->validSamplePool->missCount());
+        sqlite3_bind_int64(stmt, 15 + PerfCounters::COUNT, task->validSamplePool->checkCount());
     }
-    task->planner->setProblemDefinition(task->problemDefinitionPtr);
+    else
+    {
+        sqlite3_bind_null(stmt, 8 + PerfCounters::COUNT);
+        sqlite3_bind_null(stmt, 9 + PerfCounters::COUNT);
+        sqlite3_bind_null(stmt, 15 + PerfCounters::COUNT);
+    }
+    // acceptance and cost of the built-in valid state sampler:
+    if(task->validStateSampling.type == TaskDef::ValidStateSampling::DEFAULT)
+    {
+        sqlite3_bind_text(stmt, 10 + PerfCounters::COUNT, validstatesamplertype_string(task->validStateSampling.samplerType), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 11 + PerfCounters::COUNT, task->validStateSampling.calls);
+        sqlite3_bind_int64(stmt, 12 + PerfCounters::COUNT, task->validStateSampling.accepted);
+        sqlite3_bind_double(stmt, 13 + PerfCounters::COUNT, task->validStateSampling.nanoseconds * 1e-9);
+    }
+    else
+    {
+        for(int i = 10; i <= 13; i++)
+            sqlite3_bind_null(stmt, i + PerfCounters::COUNT);
+    }
+    sqlite3_bind_text(stmt, 14 + PerfCounters::COUNT, task->termination.reason.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
 }
 
-static int callback(void *NotUsed, int argc, char **argv, char **azColName) {
-   int i;
-   for(i = 0; i<argc; i++) {
-      printf("%s = %s\n", azColName[i], argv[i] ? argv[i] : "NULL");
-   }
-   printf("\n");
-   return 0;
-}
+// stops the threads solve() runs in the background (goal sampling, valid
+// sample pool, sample batch validation) when it returns or throws, so that
+// none of them outlives the command:
+class BackgroundSampling
+{
+public:
+    BackgroundSampling(TaskDef *task, Goal *goal)
+        : task(task), goal(goal)
+    {
+    }
+
+    ~BackgroundSampling()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        stopSampleBatches(task);
+        if(task->validSamplePool)
+            task->validSamplePool->stop();
+        if(goal)
+            goal->stopSampling();
+    }
+
+private:
+    TaskDef *task;
+    Goal *goal;
+};
 
 void solve(SScriptCallBack *p, const char *cmd, solve_in *in, solve_out *out)
 {
-
+    // the planning server (server/planningServer.cpp) answers many queries a
+    // second, and has no use for the per-call results database and logging:
+#ifndef SIM_OMPL_PLANNING_SERVER
     std::string sql;
     char *zErrMsg=0;
     int rc;
     sqlite3* db = nullptr;
-    sqlite3_open("/home/lamy/Desktop/OMPL_Compare_Task/VREP_Test_Maps/scenarios.db", &db);
+    sqlite3_open(resultsDatabase, &db);
     sql = "INSERT INTO Lamy_results (Collision_Count) VALUES (" + std::to_string(collision_count) + ")";
     char* sqlstate = strdup(sql.c_str());
     rc = sqlite3_exec(db,sqlstate,callback,0,&zErrMsg);
@@ -1415,8 +5525,97 @@ void solve(SScriptCallBack *p, const char *cmd, solve_in *in, solve_out *out)
 
     std::cout << "\nColiision Count is " <<collision_count<<std::endl;
     //collision_count=0;
+#endif
     TaskDef *task = getTask(in->taskHandle);
-    ob::PlannerStatus solved = task->planner->solve(in->maxTime);
+
+    if(!task->planner || task->portfolio.size() != task->portfolioPlanners.size())
+        throw std::string("The task must be set up (again) with setup() before solving.");
+
+    // set up the portfolio planners here, as setup is not thread safe:
+    for(size_t i = 0; i < task->portfolioPlanners.size(); i++)
+    {
+        if(!task->portfolioPlanners[i]->isSetup())
+            task->portfolioPlanners[i]->setup();
+    }
+
+    // produce goal states in the background while planning:
+    Goal *goal = dynamic_cast<Goal *>(task->problemDefinitionPtr->getGoal().get());
+    BackgroundSampling background(task, goal);
+    if(goal)
+    {
+        if(!task->planner->isSetup())
+            task->planner->setup();
+        goal->startSampling();
+    }
+
+    task->validityCheckCount = 0;
+    task->collisionCheckCount = 0;
+    task->validStateSampling.calls = 0;
+    task->validStateSampling.accepted = 0;
+    task->validStateSampling.nanoseconds = 0;
+    beginCollisionPairOrdering(task);
+    PerfCounters counters;
+    counters.start();
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    if(!task->traceFile.empty())
+        trace::begin();
+
+    if(task->validSamplePool)
+        task->validSamplePool->start();
+    startSampleBatches(task);
+
+    std::shared_ptr<TerminationState> termination = startTermination(task);
+    ob::PlannerStatus solved;
+    if(task->portfolioPlanners.empty())
+    {
+        trace::Scope scope("solve");
+        solved = task->planner->solve(terminationCondition(task, in->maxTime, termination));
+    }
+    else
+    {
+        {
+            trace::Scope scope("solvePortfolio");
+            solved = solvePortfolio(task, in->maxTime, termination);
+        }
+
+        if(task->verboseLevel >= 1)
+        {
+            std::stringstream s;
+            s << "OMPL: portfolio winner: " << (task->portfolioWinner >= 0 ? algorithm_string(task->portfolio[task->portfolioWinner]) : "none");
+            simAddStatusbarMessage(s.str().c_str());
+        }
+    }
+
+    background.stop();
+    if(task->termination.reason.empty())
+        task->termination.reason = "planner";
+    if(task->verboseLevel >= 1)
+        simAddStatusbarMessage(("OMPL: planning ended by: " + task->termination.reason).c_str());
+    if(task->validSamplePool)
+    {
+        task->validSamplePool->rethrowError();
+        if(task->verboseLevel >= 1)
+        {
+            std::stringstream s;
+            s << "OMPL: valid sample pool: " << task->validSamplePool->hitCount() << " hits, " << task->validSamplePool->missCount() << " misses, " << task->validSamplePool->depth() << " samples left, " << task->validSamplePool->checkCount() << " validity checks";
+            simAddStatusbarMessage(s.str().c_str());
+        }
+    }
+
+    double planningTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    counters.stop();
+    endCollisionPairOrdering(task);
+    task->lastPlanningTime = planningTime;
+#ifndef SIM_OMPL_PLANNING_SERVER
+    recordSolveStats(task, solved, planningTime, counters);
+#endif
+
+    if(!task->traceFile.empty())
+        trace::dump(task->traceFile);
+
+    enforceMemoryBudget(task);
+
     if(solved)
     {
         out->solved = true;
@@ -1451,10 +5650,18 @@ void simplifyPath(SScriptCallBack *p, const char *cmd, simplifyPath_in *in, simp
     const ob::PathPtr &path_ = task->problemDefinitionPtr->getSolutionPath();
     og::PathGeometric &path = static_cast<og::PathGeometric&>(*path_);
     og::PathSimplifierPtr pathSimplifier(new og::PathSimplifier(task->spaceInformationPtr));
-    if(in->maxSimplificationTime < -std::numeric_limits<double>::epsilon())
-        pathSimplifier->simplifyMax(path);
-    else
-        pathSimplifier->simplify(path, in->maxSimplificationTime);
+    // the simplification is appended to the trace of the last solve():
+    if(!task->traceFile.empty())
+        trace::resume();
+    {
+        trace::Scope scope("simplifyPath");
+        if(in->maxSimplificationTime < -std::numeric_limits<double>::epsilon())
+            pathSimplifier->simplifyMax(path);
+        else
+            pathSimplifier->simplify(path, in->maxSimplificationTime);
+    }
+    if(!task->traceFile.empty())
+        trace::dump(task->traceFile);
 
     if(task->verboseLevel >= 1)
     {
@@ -1593,6 +5800,75 @@ void isStateValid(SScriptCallBack *p, const char *cmd, isStateValid_in *in, isSt
     out->valid = task->spaceInformationPtr->isValid(s) ? 1 : 0;
 }
 
+// shared libraries loaded for native callbacks (kept loaded until the plugin is unloaded):
+std::map<std::string, void *> nativeLibraries;
+
+NativeCallbackFunction loadNativeCallback(const std::string &library, const std::string &function)
+{
+    if(library == "" || function == "")
+        throw std::string("Invalid library or function name.");
+
+    void *lib = nativeLibraries[library];
+    if(!lib)
+    {
+        lib = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if(!lib)
+            throw std::string("Cannot load library ") + library + ": " + dlerror();
+
+        const int *abiVersion = (const int *)dlsym(lib, "simOMPLNativeAbiVersion");
+        if(!abiVersion || *abiVersion != SIM_OMPL_NATIVE_ABI_VERSION)
+        {
+            dlclose(lib);
+            throw std::string("Library ") + library + " was not built for this version of the native callbacks interface (see nativeCallbacks.h).";
+        }
+
+        nativeLibraries[library] = lib;
+    }
+
+    NativeCallbackFunction f;
+    f.library = library;
+    f.function = function;
+    f.address = dlsym(lib, function.c_str());
+    if(!f.address)
+        throw std::string("Function ") + function + " not found in library " + library + ".";
+    return f;
+}
+
+void unloadNativeLibraries()
+{
+    for(std::map<std::string, void *>::iterator it = nativeLibraries.begin(); it != nativeLibraries.end(); ++it)
+    {
+        if(it->second)
+            dlclose(it->second);
+    }
+    nativeLibraries.clear();
+}
+
+void setStateValidationNative(SScriptCallBack *p, const char *cmd, setStateValidationNative_in *in, setStateValidationNative_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->stateValidation.nativeCallback = loadNativeCallback(in->library, in->function);
+    task->stateValidation.type = TaskDef::StateValidation::NATIVE;
+}
+
+void setGoalNative(SScriptCallBack *p, const char *cmd, setGoalNative_in *in, setGoalNative_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->goal.nativeCallback = loadNativeCallback(in->library, in->function);
+    task->goal.type = TaskDef::Goal::NATIVE;
+}
+
+void setValidStateSamplerNative(SScriptCallBack *p, const char *cmd, setValidStateSamplerNative_in *in, setValidStateSamplerNative_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    task->validStateSampling.nativeCallback = loadNativeCallback(in->library, in->function);
+    task->validStateSampling.nativeCallbackNear = loadNativeCallback(in->library, in->functionNear);
+    task->validStateSampling.type = TaskDef::ValidStateSampling::NATIVE;
+}
+
 void setProjectionEvaluationCallback(SScriptCallBack *p, const char *cmd, setProjectionEvaluationCallback_in *in, setProjectionEvaluationCallback_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
@@ -1616,6 +5892,32 @@ void setProjectionEvaluationCallback(SScriptCallBack *p, const char *cmd, setPro
     }
 }
 
+void setProjectionCellSizes(SScriptCallBack *p, const char *cmd, setProjectionCellSizes_in *in, setProjectionCellSizes_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    for(size_t i = 0; i < in->cellSizes.size(); i++)
+    {
+        if(in->cellSizes[i] <= 0)
+            throw std::string("Projection cell sizes must be positive.");
+    }
+
+    // an empty table restores the automatic cell sizes:
+    task->projectionEvaluation.cellSizes.clear();
+    for(size_t i = 0; i < in->cellSizes.size(); i++)
+        task->projectionEvaluation.cellSizes.push_back(in->cellSizes[i]);
+}
+
+void setProjectionCellsPerDimension(SScriptCallBack *p, const char *cmd, setProjectionCellsPerDimension_in *in, setProjectionCellsPerDimension_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->cellsPerDimension < 1)
+        throw std::string("Number of cells per dimension must be positive.");
+
+    task->projectionEvaluation.cellsPerDimension = in->cellsPerDimension;
+}
+
 void setStateValidationCallback(SScriptCallBack *p, const char *cmd, setStateValidationCallback_in *in, setStateValidationCallback_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
@@ -1634,6 +5936,24 @@ void setStateValidationCallback(SScriptCallBack *p, const char *cmd, setStateVal
     }
 }
 
+void setStateValidationBatchCallback(SScriptCallBack *p, const char *cmd, setStateValidationBatchCallback_in *in, setStateValidationBatchCallback_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->callback == "")
+    {
+        task->stateValidation.type = TaskDef::StateValidation::DEFAULT;
+        task->stateValidation.callback.scriptId = 0;
+        task->stateValidation.callback.function = "";
+    }
+    else
+    {
+        task->stateValidation.type = TaskDef::StateValidation::BATCH_CLLBACK;
+        task->stateValidation.callback.scriptId = p->scriptID;
+        task->stateValidation.callback.function = in->callback;
+    }
+}
+
 void setGoalCallback(SScriptCallBack *p, const char *cmd, setGoalCallback_in *in, setGoalCallback_out *out)
 {
     TaskDef *task = getTask(in->taskHandle);
@@ -1660,6 +5980,316 @@ void setValidStateSamplerCallback(SScriptCallBack *p, const char *cmd, setValidS
     task->validStateSampling.callbackNear.function = in->callbackNear;
 }
 
+void setValidStateSamplerBatchCallback(SScriptCallBack *p, const char *cmd, setValidStateSamplerBatchCallback_in *in, setValidStateSamplerBatchCallback_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    if(in->callback == "" || in->callbackNear == "")
+        throw std::string("Invalid callback name.");
+
+    if(in->batchSize < 1)
+        throw std::string("Batch size must be positive.");
+
+    task->validStateSampling.type = TaskDef::ValidStateSampling::BATCH_CLLBACK;
+    task->validStateSampling.callback.scriptId = p->scriptID;
+    task->validStateSampling.callback.function = in->callback;
+    task->validStateSampling.callbackNear.scriptId = p->scriptID;
+    task->validStateSampling.callbackNear.function = in->callbackNear;
+    task->validStateSampling.batchSize = in->batchSize;
+}
+
+// replaces the current obstacle map with the one in the given STL file, and
+// returns the handle of its shape:
+simInt loadMapShape(const std::string &filename)
+{
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    if(!f)
+        throw std::string("Cannot open map file ") + filename + ".";
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    uint64_t hash = mapcache::fnv1a(file.data(), file.size());
+
+    if(mapcache::currentShape != -1 && simIsHandleValid(mapcache::currentShape, sim_appobj_object_type) > 0)
+    {
+        if(hash == mapcache::currentHash)
+            return mapcache::currentShape;
+        simRemoveObject(mapcache::currentShape);
+    }
+    mapcache::currentLevels.clear();
+    mapcache::currentShape = -1;
+
+    const mapcache::Mesh &mesh = mapcache::load(filename, hash, file);
+    simInt shape = simCreateMeshShape(0, 0.5f, mesh.vertices(), 3 * mesh.header()->vertexCount, mesh.indices(), mesh.header()->indexCount, nullptr);
+    if(shape == -1)
+        throw std::string("Cannot create the shape of map ") + filename + ".";
+    simSetObjectSpecialProperty(shape, sim_objectspecialproperty_collidable | sim_objectspecialproperty_measurable | sim_objectspecialproperty_detectable_all | sim_objectspecialproperty_renderable);
+
+    mapcache::currentHash = hash;
+    mapcache::currentShape = shape;
+    return shape;
+}
+
+void loadMap(SScriptCallBack *p, const char *cmd, loadMap_in *in, loadMap_out *out)
+{
+    out->shapeHandle = loadMapShape(in->filename);
+}
+
+// parses a state stored in the scenarios table, e.g. "[0.1 -0.2 ...]":
+std::vector<simFloat> parseScenarioState(const std::string &text)
+{
+    std::string t = text;
+    std::replace(t.begin(), t.end(), '[', ' ');
+    std::replace(t.begin(), t.end(), ']', ' ');
+    std::replace(t.begin(), t.end(), ',', ' ');
+    std::istringstream s(t);
+    std::vector<simFloat> state;
+    simFloat v;
+    while(s >> v)
+        state.push_back(v);
+    return state;
+}
+
+struct ScenarioResult
+{
+    int scenarioId;
+    bool solved;
+    double planningTime;
+    double simplificationTime;
+    unsigned long validityChecks;
+    std::vector<simFloat> path;
+};
+
+// plans all the scenarios of the results database in the given id range with
+// the task's settings (state space, collision pairs, algorithm, ...), loading
+// each scenario's map, start and goal. Collision pairs referring to the
+// current map shape follow it when the map changes. Results are written in
+// one transaction at the end: a row of the results table per scenario, and
+// the interpolated path in the result_paths table.
+void runScenarios(SScriptCallBack *p, const char *cmd, runScenarios_in *in, runScenarios_out *out)
+{
+    TaskDef *task = getTask(in->taskHandle);
+
+    sqlite3 *db = nullptr;
+    if(sqlite3_open(resultsDatabase, &db) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::string("Cannot open database ") + resultsDatabase + ".";
+    }
+
+    struct Scenario
+    {
+        int id;
+        std::string map;
+        std::vector<simFloat> start, goal;
+    };
+    std::vector<Scenario> scenarios;
+    sqlite3_stmt *stmt = nullptr;
+    if(sqlite3_prepare_v2(db, "SELECT scenario_id, map_name, start_state, goal_state FROM scenarios WHERE scenario_id BETWEEN ? AND ? ORDER BY scenario_id", -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::string error = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        throw std::string("Cannot read the scenarios table: ") + error + ".";
+    }
+    sqlite3_bind_int(stmt, 1, in->firstScenarioId);
+    sqlite3_bind_int(stmt, 2, in->lastScenarioId);
+    int rc;
+    std::string error;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        Scenario sc;
+        sc.id = sqlite3_column_int(stmt, 0);
+        const char *map = (const char *)sqlite3_column_text(stmt, 1);
+        const char *start = (const char *)sqlite3_column_text(stmt, 2);
+        const char *goal = (const char *)sqlite3_column_text(stmt, 3);
+        if(!map || !start || !goal)
+        {
+            error = "Scenario " + std::to_string(sc.id) + " has no map, start state or goal state.";
+            break;
+        }
+        sc.map = map;
+        sc.start = parseScenarioState(start);
+        sc.goal = parseScenarioState(goal);
+        scenarios.push_back(sc);
+    }
+    if(error.empty() && rc != SQLITE_DONE)
+        error = std::string("Cannot read the scenarios table: ") + sqlite3_errmsg(db) + ".";
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    if(!error.empty())
+        throw error;
+
+    // each scenario's map replaces the loaded one in the collision pairs, so
+    // the task must be checked against a map loaded with loadMap:
+    if(mapcache::currentShape == -1 || std::find(task->collisionPairHandles.begin(), task->collisionPairHandles.end(), mapcache::currentShape) == task->collisionPairHandles.end())
+        throw std::string("No collision pair refers to the map loaded with loadMap(); scenarios would be planned against the wrong obstacles.");
+
+    std::string dir(resultsDatabase);
+    dir = dir.substr(0, dir.find_last_of('/') + 1);
+
+    // the task's own problem, restored at the end (with the map of the last
+    // scenario in place of its map):
+    std::vector<simFloat> savedStartState = task->startState;
+    TaskDef::Goal savedGoal = task->goal;
+    std::vector<simInt> savedCollisionPairHandles = task->collisionPairHandles;
+    simInt savedShape = mapcache::currentShape;
+    bool wasSetUp = (bool)task->planner;
+
+    // results are written even if a scenario fails, then the failure is
+    // reported:
+    std::vector<ScenarioResult> results;
+    std::exception_ptr failure;
+    try
+    {
+        for(size_t i = 0; i < scenarios.size(); i++)
+        {
+            const Scenario &sc = scenarios[i];
+
+            simInt oldShape = mapcache::currentShape;
+            simInt shape = loadMapShape(dir + sc.map + ".stl");
+            if(shape != oldShape)
+                std::replace(task->collisionPairHandles.begin(), task->collisionPairHandles.end(), oldShape, shape);
+
+            validateStateSize(task, sc.start, "Start state");
+            validateStateSize(task, sc.goal, "Goal state");
+            task->startState = sc.start;
+            task->goal.type = TaskDef::Goal::STATE;
+            task->goal.states.assign(1, sc.goal);
+
+            setup_in setupIn;
+            setup_out setupOut;
+            setupIn.taskHandle = in->taskHandle;
+            setup(p, "setup", &setupIn, &setupOut);
+
+            ScenarioResult r;
+            r.scenarioId = sc.id;
+
+            solve_in solveIn;
+            solve_out solveOut;
+            solveIn.taskHandle = in->taskHandle;
+            solveIn.maxTime = in->maxTime;
+            solve(p, "solve", &solveIn, &solveOut);
+            r.solved = solveOut.solved;
+            r.planningTime = task->lastPlanningTime;
+            r.validityChecks = task->validityCheckCount;
+            r.simplificationTime = 0.0;
+
+            if(r.solved)
+            {
+                std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+                simplifyPath_in simplifyIn;
+                simplifyPath_out simplifyOut;
+                simplifyIn.taskHandle = in->taskHandle;
+                simplifyIn.maxSimplificationTime = in->maxSimplificationTime;
+                simplifyPath(p, "simplifyPath", &simplifyIn, &simplifyOut);
+                r.simplificationTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+                interpolatePath_in interpolateIn;
+                interpolatePath_out interpolateOut;
+                interpolateIn.taskHandle = in->taskHandle;
+                interpolateIn.stateCnt = in->stateCnt;
+                interpolatePath(p, "interpolatePath", &interpolateIn, &interpolateOut);
+
+                getPath_in pathIn;
+                getPath_out pathOut;
+                pathIn.taskHandle = in->taskHandle;
+                getPath(p, "getPath", &pathIn, &pathOut);
+                r.path = pathOut.states;
+            }
+
+            if(task->verboseLevel >= 1)
+            {
+                std::stringstream s;
+                s << "OMPL: scenario " << sc.id << ": " << (r.solved ? "solved" : "not solved") << " in " << r.planningTime << "s";
+                simAddStatusbarMessage(s.str().c_str());
+            }
+
+            results.push_back(r);
+        }
+    }
+    catch(...)
+    {
+        failure = std::current_exception();
+    }
+
+    task->startState = savedStartState;
+    task->goal = savedGoal;
+    task->collisionPairHandles = savedCollisionPairHandles;
+    if(savedShape != -1 && mapcache::currentShape != savedShape)
+        std::replace(task->collisionPairHandles.begin(), task->collisionPairHandles.end(), savedShape, mapcache::currentShape);
+
+    // write everything at once:
+    if(sqlite3_open(resultsDatabase, &db) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::string("Cannot open database ") + resultsDatabase + ".";
+    }
+    sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS result_paths (experiment_id INTEGER PRIMARY KEY REFERENCES results (experiment_id), state_count INTEGER, states BLOB)", nullptr, nullptr, nullptr);
+    sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr);
+    sqlite3_stmt *resultStmt = nullptr, *pathStmt = nullptr;
+    if(sqlite3_prepare_v2(db, "INSERT INTO results (scenario_id, algorithm_name, planning_time, edt_query_count, smoothing_time, data_tag) VALUES (?, ?, ?, ?, ?, ?)", -1, &resultStmt, nullptr) != SQLITE_OK
+            || sqlite3_prepare_v2(db, "INSERT INTO result_paths (experiment_id, state_count, states) VALUES (?, ?, ?)", -1, &pathStmt, nullptr) != SQLITE_OK)
+    {
+        std::string error = sqlite3_errmsg(db);
+        sqlite3_finalize(resultStmt);
+        sqlite3_finalize(pathStmt);
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        sqlite3_close(db);
+        throw std::string("Cannot write the results: ") + error + ".";
+    }
+    out->solvedCount = 0;
+    out->totalPlanningTime = 0.0;
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const ScenarioResult &r = results[i];
+        sqlite3_reset(resultStmt);
+        sqlite3_bind_int(resultStmt, 1, r.scenarioId);
+        sqlite3_bind_text(resultStmt, 2, algorithm_string(task->algorithm), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(resultStmt, 3, r.planningTime);
+        sqlite3_bind_int64(resultStmt, 4, r.validityChecks);
+        sqlite3_bind_double(resultStmt, 5, r.simplificationTime);
+        sqlite3_bind_text(resultStmt, 6, in->dataTag.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_step(resultStmt);
+
+        if(r.solved)
+        {
+            sqlite3_reset(pathStmt);
+            sqlite3_bind_int64(pathStmt, 1, sqlite3_last_insert_rowid(db));
+            sqlite3_bind_int(pathStmt, 2, r.path.size() / task->dim);
+            sqlite3_bind_blob(pathStmt, 3, r.path.data(), r.path.size() * sizeof(simFloat), SQLITE_TRANSIENT);
+            sqlite3_step(pathStmt);
+
+            out->solvedCount++;
+        }
+        out->totalPlanningTime += r.planningTime;
+    }
+    sqlite3_finalize(resultStmt);
+    sqlite3_finalize(pathStmt);
+    sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+
+    out->scenarioCount = results.size();
+
+    // set the task up again for its own problem (after a failure, the
+    // failure is what gets reported):
+    if(wasSetUp)
+    {
+        try
+        {
+            setup_in setupIn;
+            setup_out setupOut;
+            setupIn.taskHandle = in->taskHandle;
+            setup(p, "setup", &setupIn, &setupOut);
+        }
+        catch(...)
+        {
+            if(!failure) throw;
+        }
+    }
+
+    if(failure)
+        std::rethrow_exception(failure);
+}
+
 class Plugin : public vrep::Plugin
 {
 public:
@@ -1676,6 +6306,13 @@ public:
     {
         destroyTransientObjects();
     }
+
+    void onEnd()
+    {
+        unloadNativeLibraries();
+        mapcache::unload();
+        solvestats::close();
+    }
 };
 
 VREP_PLUGIN(PLUGIN_NAME, PLUGIN_VERSION, Plugin)
@@ -0,0 +1,579 @@
+// Long-running planning server: serves start/goal queries over a Unix-domain
+// socket (protocol.h) with the plugin's StateSpace, StateValidityChecker and
+// plannerFactory, without V-REP.
+//
+// Tasks stay in memory between queries, already set up: a query only replaces
+// the start and goal, so multi-query planners (PRM, PRMstar) keep growing
+// the same roadmap. There is no scene here, so states are validated by a
+// native state validation function (nativeCallbacks.h), which is also where
+// maps and collision structures are kept warm.
+//
+// Requests are served by a pool of worker threads, one request per worker at
+// a time: the main thread watches the idle connections (poll) and hands a
+// connection to a worker when a request arrives, and the worker gives it back
+// once it has answered, so idle clients don't hold workers. Queries on
+// different tasks run concurrently; queries on the same task are serialized.
+// Creating or destroying a task waits for the running queries to finish.
+//
+// SIM_OMPL_PLANNING_SERVER leaves the results database and solve stats out of
+// solve().
+//
+// The plugin is compiled into this translation unit, so it needs the same
+// include paths and generated stubs as the plugin itself, e.g.:
+//
+//   g++ -O2 -std=c++11 -I. -I<build dir> -I$VREP/programming/include \
+//       -I$VREP/programming/v_repMath server/planningServer.cpp \
+//       <build dir>/stubs.cpp $VREP/programming/common/v_repLib.cpp \
+//       -lompl -lsqlite3 -ldl -lpthread -o planningServer
+//
+// Usage: planningServer <socket path> [worker threads]
+// Python_Program/planning_client.py is a client.
+
+#define SIM_OMPL_PLANNING_SERVER
+#include "../plugin.cpp"
+#include "protocol.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace server
+{
+    // the parts of the V-REP API used without a scene:
+    simInt getSimulationState()
+    {
+        return sim_simulation_stopped;
+    }
+
+    simInt isHandleValid(simInt generalObjectHandle, simInt generalObjectType)
+    {
+        return 0;
+    }
+
+    simInt addStatusbarMessage(const simChar *message)
+    {
+        std::fprintf(stderr, "%s\n", message);
+        return 1;
+    }
+
+    // guards the plugin's task and state space maps: queries hold it for
+    // reading, creating and destroying tasks for writing:
+    pthread_rwlock_t registryLock;
+
+    class ReadLock
+    {
+    public:
+        ReadLock() { pthread_rwlock_rdlock(&registryLock); }
+        ~ReadLock() { pthread_rwlock_unlock(&registryLock); }
+    };
+
+    class WriteLock
+    {
+    public:
+        WriteLock() { pthread_rwlock_wrlock(&registryLock); }
+        ~WriteLock() { pthread_rwlock_unlock(&registryLock); }
+    };
+
+    // per task lock, so that queries on the same task don't overlap
+    // (guarded by registryLock):
+    std::map<simInt, std::shared_ptr<std::mutex> > taskLocks;
+
+    // reads the fields of a request payload:
+    class Reader
+    {
+    public:
+        Reader(const std::vector<char> &payload)
+            : p(payload.data()), end(payload.data() + payload.size())
+        {
+        }
+
+        template<typename T>
+        T get()
+        {
+            if(end - p < (ptrdiff_t)sizeof(T))
+                throw std::string("Truncated request.");
+            T value;
+            std::memcpy(&value, p, sizeof(T));
+            p += sizeof(T);
+            return value;
+        }
+
+        std::vector<double> reals(int count)
+        {
+            std::vector<double> v(count);
+            for(int i = 0; i < count; i++)
+                v[i] = get<double>();
+            return v;
+        }
+
+        std::string string()
+        {
+            const char *nul = (const char *)std::memchr(p, 0, end - p);
+            if(!nul)
+                throw std::string("Truncated request.");
+            std::string s(p, nul);
+            p = nul + 1;
+            return s;
+        }
+
+        void finish()
+        {
+            if(p != end)
+                throw std::string("Unexpected data at the end of the request.");
+        }
+
+    private:
+        const char *p, *end;
+    };
+
+    template<typename T>
+    void put(std::string &payload, T value)
+    {
+        payload.append((const char *)&value, sizeof(T));
+    }
+
+    std::vector<simFloat> toFloats(const std::vector<double> &v)
+    {
+        return std::vector<simFloat>(v.begin(), v.end());
+    }
+
+    // replaces the start and goal of a task which is already set up; the
+    // roadmap of the multi-query planners is kept, the other planners start
+    // over:
+    void restartQuery(TaskDef *task, const std::vector<double> &start, const std::vector<double> &goal)
+    {
+        ob::ScopedState<> startState(task->stateSpacePtr), goalState(task->stateSpacePtr);
+        for(size_t i = 0; i < start.size(); i++)
+        {
+            startState[i] = start[i];
+            goalState[i] = goal[i];
+        }
+
+        const ob::ProblemDefinitionPtr &pdef = task->problemDefinitionPtr;
+        pdef->clearSolutionPaths();
+        pdef->clearStartStates();
+        pdef->addStartState(startState);
+        pdef->getGoal()->as<ob::GoalState>()->setState(goalState);
+
+        if(og::PRM *prm = dynamic_cast<og::PRM *>(task->planner.get()))
+            prm->clearQuery();
+        else
+            task->planner->clear();
+    }
+
+    // creates a task with one joint position state space per dimension, and
+    // sets it up (with the middle of the bounds as start and goal):
+    void createTask(Reader &in, std::string &out)
+    {
+        int algorithm = in.get<int32_t>();
+        int dim = in.get<int32_t>();
+        if(dim < 1 || dim > 1024)
+            throw std::string("Invalid state dimension.");
+        std::vector<double> boundsLow = in.reals(dim), boundsHigh = in.reals(dim);
+        std::string library = in.string(), function = in.string();
+        in.finish();
+
+        WriteLock lock;
+
+        ::createTask_in taskIn;
+        ::createTask_out taskOut;
+        taskIn.name = "server";
+        ::createTask(nullptr, "createTask", &taskIn, &taskOut);
+        simInt taskHandle = taskOut.taskHandle;
+
+        setStateSpace_in spaceIn;
+        setStateSpace_out spaceOut;
+        spaceIn.taskHandle = taskHandle;
+        try
+        {
+            for(int i = 0; i < dim; i++)
+            {
+                createStateSpace_in jointIn;
+                createStateSpace_out jointOut;
+                jointIn.name = "server." + std::to_string(taskHandle) + ".joint" + std::to_string(i);
+                jointIn.type = sim_ompl_statespacetype_joint_position;
+                jointIn.objectHandle = -1;
+                jointIn.boundsLow.push_back(boundsLow[i]);
+                jointIn.boundsHigh.push_back(boundsHigh[i]);
+                jointIn.useForProjection = i < 2;
+                jointIn.weight = 1.0;
+                jointIn.refObjectHandle = -1;
+                createStateSpace(nullptr, "createStateSpace", &jointIn, &jointOut);
+                spaceIn.stateSpaceHandles.push_back(jointOut.stateSpaceHandle);
+            }
+            setStateSpace(nullptr, "setStateSpace", &spaceIn, &spaceOut);
+
+            setAlgorithm_in algorithmIn;
+            setAlgorithm_out algorithmOut;
+            algorithmIn.taskHandle = taskHandle;
+            algorithmIn.algorithm = algorithm;
+            setAlgorithm(nullptr, "setAlgorithm", &algorithmIn, &algorithmOut);
+
+            setStateValidationNative_in validationIn;
+            setStateValidationNative_out validationOut;
+            validationIn.taskHandle = taskHandle;
+            validationIn.library = library;
+            validationIn.function = function;
+            setStateValidationNative(nullptr, "setStateValidationNative", &validationIn, &validationOut);
+
+            std::vector<double> middle(dim);
+            for(int i = 0; i < dim; i++)
+                middle[i] = (boundsLow[i] + boundsHigh[i]) / 2;
+
+            setStartState_in startIn;
+            setStartState_out startOut;
+            startIn.taskHandle = taskHandle;
+            startIn.state = toFloats(middle);
+            setStartState(nullptr, "setStartState", &startIn, &startOut);
+
+            setGoalState_in goalIn;
+            setGoalState_out goalOut;
+            goalIn.taskHandle = taskHandle;
+            goalIn.state = toFloats(middle);
+            setGoalState(nullptr, "setGoalState", &goalIn, &goalOut);
+
+            setup_in setupIn;
+            setup_out setupOut;
+            setupIn.taskHandle = taskHandle;
+            setup(nullptr, "setup", &setupIn, &setupOut);
+        }
+        catch(...)
+        {
+            destroyTask_in destroyIn;
+            destroyTask_out destroyOut;
+            destroyIn.taskHandle = taskHandle;
+            destroyTask(nullptr, "destroyTask", &destroyIn, &destroyOut);
+            for(size_t i = 0; i < spaceIn.stateSpaceHandles.size(); i++)
+            {
+                destroyStateSpace_in spaceDestroyIn;
+                destroyStateSpace_out spaceDestroyOut;
+                spaceDestroyIn.stateSpaceHandle = spaceIn.stateSpaceHandles[i];
+                destroyStateSpace(nullptr, "destroyStateSpace", &spaceDestroyIn, &spaceDestroyOut);
+            }
+            throw;
+        }
+
+        taskLocks[taskHandle] = std::make_shared<std::mutex>();
+        put<int32_t>(out, taskHandle);
+    }
+
+    void solveQuery(Reader &in, std::string &out)
+    {
+        simInt taskHandle = in.get<int32_t>();
+        double maxTime = in.get<double>();
+        double maxSimplificationTime = in.get<double>();
+
+        ReadLock lock;
+
+        std::map<simInt, std::shared_ptr<std::mutex> >::iterator it = taskLocks.find(taskHandle);
+        if(it == taskLocks.end())
+            throw std::string("Invalid task handle.");
+        std::lock_guard<std::mutex> taskLock(*it->second);
+        TaskDef *task = getTask(taskHandle);
+
+        std::vector<double> start = in.reals(task->dim), goal = in.reals(task->dim);
+        in.finish();
+
+        setStartState_in startIn;
+        setStartState_out startOut;
+        startIn.taskHandle = taskHandle;
+        startIn.state = toFloats(start);
+        setStartState(nullptr, "setStartState", &startIn, &startOut);
+
+        setGoalState_in goalIn;
+        setGoalState_out goalOut;
+        goalIn.taskHandle = taskHandle;
+        goalIn.state = toFloats(goal);
+        setGoalState(nullptr, "setGoalState", &goalIn, &goalOut);
+
+        restartQuery(task, start, goal);
+
+        solve_in solveIn;
+        solve_out solveOut;
+        solveIn.taskHandle = taskHandle;
+        solveIn.maxTime = maxTime;
+        solve(nullptr, "solve", &solveIn, &solveOut);
+
+        put<int32_t>(out, solveOut.solved ? 1 : 0);
+        if(!solveOut.solved)
+        {
+            put<int32_t>(out, 0);
+            return;
+        }
+
+        if(maxSimplificationTime != 0)
+        {
+            simplifyPath_in simplifyIn;
+            simplifyPath_out simplifyOut;
+            simplifyIn.taskHandle = taskHandle;
+            simplifyIn.maxSimplificationTime = maxSimplificationTime;
+            simplifyPath(nullptr, "simplifyPath", &simplifyIn, &simplifyOut);
+        }
+
+        og::PathGeometric &path = static_cast<og::PathGeometric&>(*task->problemDefinitionPtr->getSolutionPath());
+        put<int32_t>(out, path.getStateCount());
+        std::vector<double> v;
+        for(size_t i = 0; i < path.getStateCount(); i++)
+        {
+            task->stateSpacePtr->copyToReals(v, path.getState(i));
+            for(size_t j = 0; j < v.size(); j++)
+                put<double>(out, v[j]);
+        }
+    }
+
+    void destroyQuery(Reader &in, std::string &out)
+    {
+        simInt taskHandle = in.get<int32_t>();
+        in.finish();
+
+        WriteLock lock;
+
+        if(taskLocks.find(taskHandle) == taskLocks.end())
+            throw std::string("Invalid task handle.");
+        std::vector<simInt> stateSpaces = getTask(taskHandle)->stateSpaces;
+
+        destroyTask_in destroyIn;
+        destroyTask_out destroyOut;
+        destroyIn.taskHandle = taskHandle;
+        destroyTask(nullptr, "destroyTask", &destroyIn, &destroyOut);
+        for(size_t i = 0; i < stateSpaces.size(); i++)
+        {
+            destroyStateSpace_in spaceDestroyIn;
+            destroyStateSpace_out spaceDestroyOut;
+            spaceDestroyIn.stateSpaceHandle = stateSpaces[i];
+            destroyStateSpace(nullptr, "destroyStateSpace", &spaceDestroyIn, &spaceDestroyOut);
+        }
+        taskLocks.erase(taskHandle);
+    }
+
+    bool readFully(int fd, void *buffer, size_t size)
+    {
+        char *p = (char *)buffer;
+        while(size > 0)
+        {
+            ssize_t n = read(fd, p, size);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool writeFully(int fd, const void *buffer, size_t size)
+    {
+        const char *p = (const char *)buffer;
+        while(size > 0)
+        {
+            ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // answers one request of a client; returns false if the connection must
+    // be closed:
+    bool serve(int fd)
+    {
+        simOMPLServerRequest request;
+        if(!readFully(fd, &request, sizeof(request)) || request.length > SIM_OMPL_SERVER_MAX_PAYLOAD)
+            return false;
+        std::vector<char> payload(request.length);
+        if(!readFully(fd, payload.data(), payload.size()))
+            return false;
+
+        simOMPLServerResponse header;
+        header.status = SIM_OMPL_SERVER_OK;
+        std::string response;
+        try
+        {
+            Reader in(payload);
+            switch(request.op)
+            {
+            case SIM_OMPL_SERVER_CREATE_TASK:
+                createTask(in, response);
+                break;
+            case SIM_OMPL_SERVER_SOLVE:
+                solveQuery(in, response);
+                break;
+            case SIM_OMPL_SERVER_DESTROY_TASK:
+                destroyQuery(in, response);
+                break;
+            default:
+                throw std::string("Invalid request.");
+            }
+        }
+        catch(std::string &error)
+        {
+            header.status = SIM_OMPL_SERVER_ERROR;
+            response = error;
+        }
+        catch(std::exception &error)
+        {
+            header.status = SIM_OMPL_SERVER_ERROR;
+            response = error.what();
+        }
+
+        header.length = response.size();
+        return writeFully(fd, &header, sizeof(header)) && writeFully(fd, response.data(), response.size());
+    }
+
+    // connections with a request to read, waiting for a worker:
+    std::deque<int> connections;
+    std::mutex connectionsMutex;
+    std::condition_variable connectionsCondition;
+
+    // connections answered by a worker, to be watched again by the main
+    // thread, which is woken up through wakePipe:
+    std::vector<int> answered;
+    std::mutex answeredMutex;
+    int wakePipe[2];
+
+    void worker()
+    {
+        while(true)
+        {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(connectionsMutex);
+                connectionsCondition.wait(lock, [] { return !connections.empty(); });
+                fd = connections.front();
+                connections.pop_front();
+            }
+            if(!serve(fd))
+            {
+                close(fd);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(answeredMutex);
+                answered.push_back(fd);
+            }
+            char c = 0;
+            while(write(wakePipe[1], &c, 1) < 0 && errno == EINTR);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s <socket path> [worker threads]\n", argv[0]);
+        return 1;
+    }
+    const char *socketPath = argv[1];
+    int workerCount = argc > 2 ? std::atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    if(workerCount < 1) workerCount = 1;
+
+    simGetSimulationState = server::getSimulationState;
+    simIsHandleValid = server::isHandleValid;
+    simAddStatusbarMessage = server::addStatusbarMessage;
+
+    // writers first, so that creating a task doesn't wait for ever under a
+    // steady stream of queries:
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&server::registryLock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(std::strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        std::fprintf(stderr, "socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    std::strcpy(address.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if(listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 128) < 0)
+    {
+        std::perror(socketPath);
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if(pipe(server::wakePipe) < 0)
+    {
+        std::perror("pipe");
+        return 1;
+    }
+    // the workers may wake the main thread more often than it reads:
+    fcntl(server::wakePipe[1], F_SETFL, O_NONBLOCK);
+
+    for(int i = 0; i < workerCount; i++)
+        std::thread(server::worker).detach();
+    std::fprintf(stderr, "planningServer: listening on %s with %d workers\n", socketPath, workerCount);
+
+    // the connections waiting for their next request:
+    std::vector<int> idle;
+    std::vector<pollfd> fds;
+    while(true)
+    {
+        fds.clear();
+        pollfd listenerFd = {listener, POLLIN, 0}, wakeFd = {server::wakePipe[0], POLLIN, 0};
+        fds.push_back(listenerFd);
+        fds.push_back(wakeFd);
+        for(size_t i = 0; i < idle.size(); i++)
+        {
+            pollfd connectionFd = {idle[i], POLLIN, 0};
+            fds.push_back(connectionFd);
+        }
+        if(poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            std::perror("poll");
+            return 1;
+        }
+
+        // hand the connections with a request (or closed) to the workers:
+        std::vector<int> stillIdle;
+        {
+            std::lock_guard<std::mutex> lock(server::connectionsMutex);
+            for(size_t i = 0; i < idle.size(); i++)
+            {
+                if(fds[i + 2].revents)
+                    server::connections.push_back(idle[i]);
+                else
+                    stillIdle.push_back(idle[i]);
+            }
+        }
+        if(stillIdle.size() < idle.size())
+            server::connectionsCondition.notify_all();
+        idle.swap(stillIdle);
+
+        if(fds[1].revents)
+        {
+            char buffer[64];
+            while(read(server::wakePipe[0], buffer, sizeof(buffer)) < 0 && errno == EINTR);
+            std::lock_guard<std::mutex> lock(server::answeredMutex);
+            idle.insert(idle.end(), server::answered.begin(), server::answered.end());
+            server::answered.clear();
+        }
+
+        if(fds[0].revents)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0)
+            {
+                if(errno == EINTR || errno == ECONNABORTED) continue;
+                std::perror("accept");
+                return 1;
+            }
+            idle.push_back(fd);
+        }
+    }
+}
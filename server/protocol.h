@@ -0,0 +1,55 @@
+#ifndef PLANNING_SERVER_PROTOCOL_H_INCLUDED
+#define PLANNING_SERVER_PROTOCOL_H_INCLUDED
+
+/*
+ * Binary protocol of the planning server (planningServer.cpp), spoken over a
+ * Unix-domain stream socket.
+ *
+ * Every request is a simOMPLServerRequest header followed by length bytes of
+ * payload, and gets a simOMPLServerResponse header followed by length bytes
+ * of payload. Integers are int32, reals are doubles, all in the byte order of
+ * the host. A client may send any number of requests on one connection.
+ *
+ * CREATE_TASK  request:  algorithm (sim_ompl_algorithm_* value), dim,
+ *                        boundsLow[dim], boundsHigh[dim],
+ *                        library\0, function\0 (native state validation
+ *                        function, see nativeCallbacks.h)
+ *              response: taskHandle
+ *
+ * SOLVE        request:  taskHandle, maxTime, maxSimplificationTime (0: don't
+ *                        simplify, negative: simplify until no improvement),
+ *                        start[dim], goal[dim]
+ *              response: solved, stateCount, states[stateCount * dim]
+ *
+ * DESTROY_TASK request:  taskHandle
+ *              response: (empty)
+ *
+ * If status is not SIM_OMPL_SERVER_OK, the response payload is the error
+ * message (not null terminated).
+ */
+
+#include <stdint.h>
+
+#define SIM_OMPL_SERVER_CREATE_TASK 1
+#define SIM_OMPL_SERVER_SOLVE 2
+#define SIM_OMPL_SERVER_DESTROY_TASK 3
+
+#define SIM_OMPL_SERVER_OK 0
+#define SIM_OMPL_SERVER_ERROR 1
+
+/* requests bigger than this are rejected (and the connection closed) */
+#define SIM_OMPL_SERVER_MAX_PAYLOAD (16 * 1024 * 1024)
+
+struct simOMPLServerRequest
+{
+    int32_t op;
+    uint32_t length;
+};
+
+struct simOMPLServerResponse
+{
+    int32_t status;
+    uint32_t length;
+};
+
+#endif /* PLANNING_SERVER_PROTOCOL_H_INCLUDED */